@@ -22,22 +22,696 @@
 #endif				/* HAVE_CONFIG_H */
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <dirent.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "mutt.h"
 #include "account.h"
 #include "url.h"
+#include "hash.h"
+#include "mx.h"
 #include "bcache.h"
 
 #include "lib.h"
 
+#ifdef USE_ZLIB
+#include <zlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* messages of a mailbox are spread over up to 256 subdirectories named
+ * after two hex digits of a hash of the id, so that no directory grows
+ * too large. The names start with a dot, so they can't be mistaken for
+ * the cache of a subfolder, which lives in the same directory: the shard
+ * 01 of Archive/2023 is not the mailbox Archive/2023/01. */
+#define BCACHE_SHARDS 256
+
+/* name of the index below $message_cachedir */
+#define BCACHE_INDEX ".bcache-index"
+
 struct body_cache {
   char path[_POSIX_PATH_MAX];
   size_t pathlen;
+  size_t rootlen;		/* length of the $message_cachedir part of path */
 };
 
+/*
+ * The index is a log shared by all body caches below $message_cachedir,
+ * and by all mutt processes using it. Each line is one of
+ *
+ *   + <size> <key>	file added or replaced
+ *   * <size> <key>	file read
+ *   - <key>		file removed
+ *
+ * where <key> is the path of the file relative to $message_cachedir.
+ * Replaying it leaves the files in least recently used order, which is
+ * the order they are evicted in once $message_cache_size is exceeded.
+ * The log is rewritten in compact form when it has grown much larger
+ * than the number of files, and rebuilt from the files themselves if it
+ * is missing. Reading and appending to it, and compacting it, happen
+ * under an fcntl/flock lock (see index_lock). Since files may be removed by hand at any time, it is
+ * only a hint: operations on missing files are simply dropped from it.
+ */
+typedef struct bcache_entry
+{
+  char *key;
+  long size;
+  struct bcache_entry *prev;
+  struct bcache_entry *next;
+} BCACHE_ENTRY;
+
+static struct
+{
+  char root[_POSIX_PATH_MAX];	/* $message_cachedir with trailing '/' */
+  char path[_POSIX_PATH_MAX];
+  FILE *fp;			/* opened for reading and appending */
+  ino_t ino;
+  HASH *hash;
+  BCACHE_ENTRY *head;		/* least recently used */
+  BCACHE_ENTRY *tail;
+  LOFF_T total;			/* bytes in all files */
+  int count;
+  int lines;			/* lines in the log */
+} Index;
+
+static unsigned int bcache_shard (const char *id)
+{
+  unsigned int h = 0;
+
+  while (*id)
+    h = (h << 5) + h + (unsigned char) *id++;
+
+  return h % BCACHE_SHARDS;
+}
+
+static int bcache_is_shard (const char *name)
+{
+  return name[0] == '.' && strspn (name + 1, "0123456789abcdef") == 2
+    && !name[3];
+}
+
+/* header caches (and their lock files) may share the directories */
+static int bcache_is_hcache (const char *name)
+{
+  return strstr (name, ".hcache") != NULL;
+}
+
+/* whether a file directly in a mailbox's cache directory could be a message
+ * cached before sharding: not a header cache, a leftover temporary file
+ * or anything of ours */
+static int bcache_is_id (const char *name)
+{
+  size_t len = mutt_strlen (name);
+
+  return len && name[0] != '.' && !bcache_is_hcache (name)
+    && !(len > 4 && !mutt_strcmp (name + len - 4, ".tmp"));
+}
+
+/* path of the file for id in bcache, with an optional suffix */
+static void bcache_file (body_cache_t *bcache, const char *id,
+			 const char *suffix, char *dst, size_t dstlen)
+{
+  snprintf (dst, dstlen, "%s.%02x/%s%s", bcache->path, bcache_shard (id),
+	    id, NONULL (suffix));
+}
+
+/* collapse runs of '/' in path */
+static void bcache_squeeze (char *path)
+{
+  char *s, *d;
+
+  for (s = d = path; *s; s++)
+    if (*s != '/' || d == path || d[-1] != '/')
+      *d++ = *s;
+  *d = '\0';
+}
+
+/* create the missing directories leading to path */
+static int bcache_mkdir (char *path)
+{
+  struct stat sb;
+  char *s;
+  int rc = 0;
+
+  for (s = strchr (path + 1, '/'); s && !rc; s = strchr (s + 1, '/'))
+  {
+    *s = '\0';
+    if (stat (path, &sb) < 0 && (errno != ENOENT || mkdir (path, 0777) < 0))
+      rc = -1;
+    *s = '/';
+  }
+
+  return rc;
+}
+
+static void index_remove_entry (BCACHE_ENTRY *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    Index.head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    Index.tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void index_append_entry (BCACHE_ENTRY *e)
+{
+  e->prev = Index.tail;
+  if (Index.tail)
+    Index.tail->next = e;
+  else
+    Index.head = e;
+  Index.tail = e;
+}
+
+static void index_add (const char *key, long size)
+{
+  BCACHE_ENTRY *e;
+
+  if ((e = hash_find (Index.hash, key)))
+  {
+    Index.total -= e->size;
+    index_remove_entry (e);
+  }
+  else
+  {
+    e = safe_calloc (1, sizeof (BCACHE_ENTRY));
+    e->key = safe_strdup (key);
+    hash_insert (Index.hash, e->key, e, 0);
+    Index.count++;
+  }
+
+  e->size = size;
+  Index.total += size;
+  index_append_entry (e);
+}
+
+/* size is the current size of the file, or -1 if unknown */
+static void index_touch (const char *key, long size)
+{
+  BCACHE_ENTRY *e;
+
+  if ((e = hash_find (Index.hash, key)))
+  {
+    if (size >= 0 && size != e->size)
+    {
+      Index.total += size - e->size;
+      e->size = size;
+    }
+    index_remove_entry (e);
+    index_append_entry (e);
+  }
+}
+
+static void index_del (const char *key)
+{
+  BCACHE_ENTRY *e;
+
+  if (!(e = hash_find (Index.hash, key)))
+    return;
+
+  index_remove_entry (e);
+  hash_delete (Index.hash, e->key, e, NULL);
+  Index.total -= e->size;
+  Index.count--;
+  FREE (&e->key);
+  FREE (&e);
+}
+
+/* apply a line of the log */
+static void index_apply (char *line)
+{
+  char *key;
+  long size;
+
+  mutt_remove_trailing_ws (line);
+  if (!line[0] || line[1] != ' ')
+    return;
+
+  switch (line[0])
+  {
+    case '+':
+      size = strtol (line + 2, &key, 10);
+      if (*key++ == ' ' && *key)
+	index_add (key, size);
+      break;
+    case '*':
+      size = strtol (line + 2, &key, 10);
+      if (*key++ == ' ' && *key)
+	index_touch (key, size);
+      break;
+    case '-':
+      index_del (line + 2);
+      break;
+  }
+}
+
+static void index_close (void)
+{
+  BCACHE_ENTRY *e, *next;
+
+  for (e = Index.head; e; e = next)
+  {
+    next = e->next;
+    FREE (&e->key);
+    FREE (&e);
+  }
+  Index.head = Index.tail = NULL;
+  if (Index.hash)
+    hash_destroy (&Index.hash, NULL);
+  safe_fclose (&Index.fp);
+  Index.total = 0;
+  Index.count = 0;
+  Index.lines = 0;
+}
+
+typedef struct
+{
+  char *key;
+  long size;
+  time_t mtime;
+} BCACHE_FILE;
+
+static int bcache_file_cmp (const void *a, const void *b)
+{
+  const BCACHE_FILE *fa = a, *fb = b;
+
+  return fa->mtime < fb->mtime ? -1 : fa->mtime > fb->mtime;
+}
+
+/* collect the message files below path, which has room for
+ * _POSIX_PATH_MAX characters */
+static void index_scan (char *path, int shard, BCACHE_FILE **files,
+			int *nfiles, int *maxfiles)
+{
+  DIR *d;
+  struct dirent *de;
+  struct stat sb;
+  size_t len = mutt_strlen (path);
+
+  if (!(d = opendir (path)))
+    return;
+
+  while ((de = readdir (d)))
+  {
+    if (de->d_name[0] == '.' && !bcache_is_shard (de->d_name))
+      continue;
+
+    snprintf (path + len, _POSIX_PATH_MAX - len, "%s", de->d_name);
+    if (lstat (path, &sb) < 0)
+      continue;
+
+    if (S_ISDIR (sb.st_mode))
+    {
+      safe_strcat (path, _POSIX_PATH_MAX, "/");
+      index_scan (path, bcache_is_shard (de->d_name), files, nfiles, maxfiles);
+    }
+    else if (shard && S_ISREG (sb.st_mode) && !bcache_is_hcache (de->d_name))
+    {
+      if (*nfiles == *maxfiles)
+      {
+	*maxfiles += 256;
+	safe_realloc (files, *maxfiles * sizeof (BCACHE_FILE));
+      }
+      (*files)[*nfiles].key = safe_strdup (path + mutt_strlen (Index.root));
+      (*files)[*nfiles].size = sb.st_size;
+      (*files)[*nfiles].mtime = sb.st_mtime;
+      (*nfiles)++;
+    }
+  }
+  path[len] = '\0';
+
+  closedir (d);
+}
+
+/* rebuild the index from the files, oldest first */
+static void index_rebuild (void)
+{
+  char path[_POSIX_PATH_MAX];
+  BCACHE_FILE *files = NULL;
+  int i, nfiles = 0, maxfiles = 0;
+
+  strfcpy (path, Index.root, sizeof (path));
+  index_scan (path, 0, &files, &nfiles, &maxfiles);
+  qsort (files, nfiles, sizeof (BCACHE_FILE), bcache_file_cmp);
+
+  for (i = 0; i < nfiles; i++)
+  {
+    index_add (files[i].key, files[i].size);
+    FREE (&files[i].key);
+  }
+  FREE (&files);
+
+  dprint (2, (debugfile, "bcache: index: rebuilt with %d files\n", nfiles));
+}
+
+/* replace the log with one line per file */
+static void index_write (void)
+{
+  char tmp[_POSIX_PATH_MAX];
+  struct stat sb;
+  BCACHE_ENTRY *e;
+  FILE *fp;
+
+  snprintf (tmp, sizeof (tmp), "%s.tmp", Index.path);
+  mutt_unlink (tmp);
+  if (!(fp = safe_fopen (tmp, "w")))
+  {
+    dprint (1, (debugfile, "bcache: index: can't write %s: %s\n", tmp,
+		strerror (errno)));
+    return;
+  }
+
+  for (e = Index.head; e; e = e->next)
+    fprintf (fp, "+ %ld %s\n", e->size, e->key);
+
+  if (safe_fclose (&fp) < 0 || rename (tmp, Index.path) < 0)
+  {
+    mutt_unlink (tmp);
+    return;
+  }
+
+  safe_fclose (&Index.fp);
+  if ((Index.fp = fopen (Index.path, "a+")) && fstat (fileno (Index.fp), &sb) == 0)
+  {
+    fseek (Index.fp, 0, SEEK_END);
+    Index.ino = sb.st_ino;
+  }
+  Index.lines = Index.count;
+}
+
+/* catch up with what other processes have logged, or reload the index if
+ * it has been replaced or removed */
+static void index_sync (void)
+{
+  char buf[_POSIX_PATH_MAX + SHORT_STRING];
+  struct stat sb;
+
+  if (stat (Index.path, &sb) < 0)
+  {
+    index_close ();
+    Index.hash = hash_create (4093, 0);
+    index_rebuild ();
+    index_write ();
+    return;
+  }
+
+  if (!Index.fp || sb.st_ino != Index.ino)
+  {
+    index_close ();
+    Index.hash = hash_create (4093, 0);
+    if (!(Index.fp = fopen (Index.path, "a+")))
+      return;
+    Index.ino = sb.st_ino;
+    rewind (Index.fp);
+  }
+  else
+    /* switch from appending to reading */
+    fseek (Index.fp, 0, SEEK_CUR);
+
+  while (fgets (buf, sizeof (buf), Index.fp))
+  {
+    /* leave a line that is still being written for next time */
+    if (!strchr (buf, '\n') && feof (Index.fp))
+    {
+      fseek (Index.fp, - (long) mutt_strlen (buf), SEEK_CUR);
+      break;
+    }
+    index_apply (buf);
+    Index.lines++;
+  }
+  clearerr (Index.fp);
+}
+
+/* lock the log, following it to its newest file: a process compacting it
+ * renames a new file over the one another may be waiting to lock, and
+ * what that one would append to the old file would be lost. */
+static int index_lock (void)
+{
+  struct stat sb;
+  int i;
+
+  for (i = 0; i < 3 && Index.fp; i++)
+  {
+    if (mx_lock_file (Index.path, fileno (Index.fp), 1, 0, 1) < 0)
+      return -1;
+    if (stat (Index.path, &sb) == 0 && sb.st_ino == Index.ino)
+      return 0;
+
+    mx_unlock_file (Index.path, fileno (Index.fp), 0);
+    index_sync ();
+  }
+
+  dprint (1, (debugfile, "bcache: index: can't lock %s\n", Index.path));
+  return -1;
+}
+
+/* the lock goes away by itself if index_write has closed the file */
+static void index_unlock (void)
+{
+  if (Index.fp)
+    mx_unlock_file (Index.path, fileno (Index.fp), 0);
+}
+
+/* apply an operation on key and append it to the log */
+static void index_record (char op, const char *key, long size)
+{
+  switch (op)
+  {
+    case '+':
+      index_add (key, size);
+      break;
+    case '*':
+      index_touch (key, size);
+      break;
+    case '-':
+      index_del (key);
+      break;
+  }
+
+  if (!Index.fp)
+    return;
+
+  fseek (Index.fp, 0, SEEK_END);
+  if (op == '-')
+    fprintf (Index.fp, "- %s\n", key);
+  else
+    fprintf (Index.fp, "%c %ld %s\n", op, size, key);
+  fflush (Index.fp);
+
+  if (++Index.lines > 2 * Index.count + 1024)
+    index_write ();
+}
+
+/* log an operation on the file path */
+static void index_log (char op, const char *path, long size)
+{
+  size_t rootlen = mutt_strlen (Index.root);
+  int locked;
+
+  if (!Index.fp || mutt_strncmp (path, Index.root, rootlen))
+    return;
+
+  /* don't log reads and removals of files we don't know about */
+  if (op != '+' && !hash_find (Index.hash, path + rootlen))
+    return;
+
+  locked = index_lock () == 0;
+  index_sync ();
+  index_record (op, path + rootlen, size);
+  if (locked)
+    index_unlock ();
+}
+
+/* open the index for the $message_cachedir path starts with */
+static void index_open (const char *path, size_t rootlen)
+{
+  if (rootlen >= sizeof (Index.root))
+    return;
+
+  if (mutt_strncmp (Index.root, path, rootlen) || Index.root[rootlen])
+  {
+    index_close ();
+    strfcpy (Index.root, path, rootlen + 1);
+    snprintf (Index.path, sizeof (Index.path), "%s%s", Index.root, BCACHE_INDEX);
+    bcache_mkdir (Index.path);
+  }
+
+  index_sync ();
+}
+
+/* remove the least recently used files until the cache fits into
+ * $message_cache_size, but never the file path */
+static void index_evict (const char *path)
+{
+  char file[_POSIX_PATH_MAX];
+  const char *key = path + mutt_strlen (Index.root);
+  LOFF_T limit = (LOFF_T) MessageCacheSize * 1024 * 1024;
+  int locked, n = 0;
+
+  if (MessageCacheSize <= 0 || !Index.fp)
+    return;
+
+  locked = index_lock () == 0;
+  index_sync ();
+  while (Index.total > limit && Index.head && mutt_strcmp (Index.head->key, key))
+  {
+    snprintf (file, sizeof (file), "%s%s", Index.root, Index.head->key);
+    dprint (3, (debugfile, "bcache: evict: '%s'\n", file));
+    unlink (file);
+    index_record ('-', file + mutt_strlen (Index.root), 0);
+    n++;
+  }
+  if (locked)
+    index_unlock ();
+
+  if (n)
+    dprint (2, (debugfile, "bcache: evicted %d files, " OFF_T_FMT " bytes in cache\n",
+		n, Index.total));
+}
+
+#ifdef USE_ZLIB
+/* gzip files start with these bytes, which can't start a message */
+#define BCACHE_GZIP_MAGIC "\037\213"
+
+/* write a gzip compressed copy of src to dst */
+static int bcache_compress (const char *src, const char *dst)
+{
+  char buf[BUFSIZ];
+  FILE *in;
+  gzFile out;
+  size_t n;
+  int fd, rc = 0;
+
+  if (!(in = fopen (src, "r")))
+    return -1;
+
+  if ((fd = safe_open (dst, O_WRONLY | O_CREAT | O_EXCL)) < 0)
+  {
+    safe_fclose (&in);
+    return -1;
+  }
+  if (!(out = gzdopen (fd, "wb")))
+  {
+    close (fd);
+    safe_fclose (&in);
+    unlink (dst);
+    return -1;
+  }
+
+  while ((n = fread (buf, 1, sizeof (buf), in)) > 0)
+    if (gzwrite (out, buf, n) != (int) n)
+    {
+      rc = -1;
+      break;
+    }
+
+  if (ferror (in))
+    rc = -1;
+  if (gzclose (out) != Z_OK)
+    rc = -1;
+  safe_fclose (&in);
+
+  if (rc < 0)
+    unlink (dst);
+
+  return rc;
+}
+
+/* if fp is compressed, replace it with an uncompressed temporary copy so
+ * that callers get a seekable stream either way */
+static FILE *bcache_uncompress (FILE *fp)
+{
+  char magic[2];
+  char buf[BUFSIZ];
+  char tempfile[_POSIX_PATH_MAX];
+  gzFile in = NULL;
+  FILE *out = NULL;
+  int fd, n = 0;
+
+  if (fread (magic, 1, sizeof (magic), fp) != sizeof (magic)
+      || memcmp (magic, BCACHE_GZIP_MAGIC, sizeof (magic)))
+  {
+    rewind (fp);
+    return fp;
+  }
+
+  mutt_mktemp (tempfile, sizeof (tempfile));
+  if ((out = safe_fopen (tempfile, "w+")))
+    unlink (tempfile);
+
+  if (out && (fd = dup (fileno (fp))) >= 0)
+  {
+    lseek (fd, 0, SEEK_SET);
+    if (!(in = gzdopen (fd, "rb")))
+      close (fd);
+  }
+
+  if (in)
+  {
+    while ((n = gzread (in, buf, sizeof (buf))) > 0)
+      if (fwrite (buf, 1, n, out) != (size_t) n)
+	break;
+    gzclose (in);
+  }
+
+  safe_fclose (&fp);
+  if (!in || n != 0 || fflush (out) != 0)
+  {
+    dprint (1, (debugfile, "bcache: can't uncompress message\n"));
+    safe_fclose (&out);
+    return NULL;
+  }
+
+  rewind (out);
+  return out;
+}
+#endif /* USE_ZLIB */
+
+/* move the files of a mailbox cached before sharding into place. Only
+ * plain files are moved: directories are the caches of subfolders */
+static void bcache_migrate (body_cache_t *bcache)
+{
+  char path[_POSIX_PATH_MAX];
+  char newpath[_POSIX_PATH_MAX];
+  DIR *d;
+  struct dirent *de;
+  struct stat sb;
+  int n = 0;
+
+  if (!(d = opendir (bcache->path)))
+    return;
+
+  while ((de = readdir (d)))
+  {
+    if (!bcache_is_id (de->d_name))
+      continue;
+
+    snprintf (path, sizeof (path), "%s%s", bcache->path, de->d_name);
+    if (lstat (path, &sb) < 0 || !S_ISREG (sb.st_mode))
+      continue;
+
+    bcache_file (bcache, de->d_name, NULL, newpath, sizeof (newpath));
+    if (bcache_mkdir (newpath) < 0 || rename (path, newpath) < 0)
+      continue;
+    index_log ('+', newpath, sb.st_size);
+    n++;
+  }
+
+  closedir (d);
+
+  if (n)
+    dprint (2, (debugfile, "bcache: moved %d files of '%s' into shards\n",
+		n, bcache->path));
+}
+
 static int bcache_path(ACCOUNT *account, const char *mailbox,
 		       char *dst, size_t dstlen)
 {
@@ -82,6 +756,7 @@ static int bcache_path(ACCOUNT *account, const char *mailbox,
 body_cache_t *mutt_bcache_open (ACCOUNT *account, const char *mailbox)
 {
   struct body_cache *bcache = NULL;
+  char root[_POSIX_PATH_MAX];
 
   if (!account)
     goto bail;
@@ -90,7 +765,15 @@ body_cache_t *mutt_bcache_open (ACCOUNT *account, const char *mailbox)
   if (bcache_path (account, mailbox, bcache->path,
 		   sizeof (bcache->path)) < 0)
     goto bail;
+  /* index keys must be spelled the same way as the paths found on disk */
+  bcache_squeeze (bcache->path);
   bcache->pathlen = mutt_strlen (bcache->path);
+  snprintf (root, sizeof (root), "%s/", MessageCachedir);
+  bcache_squeeze (root);
+  bcache->rootlen = mutt_strlen (root);
+
+  index_open (bcache->path, bcache->rootlen);
+  bcache_migrate (bcache);
 
   return bcache;
 
@@ -111,18 +794,28 @@ FILE* mutt_bcache_get(body_cache_t *bcache, const char *id)
 {
   char path[_POSIX_PATH_MAX];
   FILE* fp = NULL;
+  struct stat sb;
 
   if (!id || !*id || !bcache)
     return NULL;
 
-  path[0] = '\0';
-  safe_strncat (path, sizeof (path), bcache->path, bcache->pathlen);
-  safe_strncat (path, sizeof (path), id, mutt_strlen (id));
+  bcache_file (bcache, id, NULL, path, sizeof (path));
 
   fp = safe_fopen (path, "r");
 
   dprint (3, (debugfile, "bcache: get: '%s': %s\n", path, fp == NULL ? "no" : "yes"));
 
+  /* the file may have been removed behind our back */
+  if (!fp)
+    index_log ('-', path, 0);
+  else if (fstat (fileno (fp), &sb) == 0)
+    index_log ('*', path, sb.st_size);
+
+#ifdef USE_ZLIB
+  if (fp)
+    fp = bcache_uncompress (fp);
+#endif
+
   return fp;
 }
 
@@ -130,14 +823,11 @@ FILE* mutt_bcache_put(body_cache_t *bcache, const char *id, int tmp)
 {
   char path[_POSIX_PATH_MAX];
   FILE* fp;
-  char* s;
-  struct stat sb;
 
   if (!id || !*id || !bcache)
     return NULL;
 
-  snprintf (path, sizeof (path), "%s%s%s", bcache->path, id,
-            tmp ? ".tmp" : "");
+  bcache_file (bcache, id, tmp ? ".tmp" : NULL, path, sizeof (path));
 
   if ((fp = safe_fopen (path, "w+")))
     goto out;
@@ -146,16 +836,9 @@ FILE* mutt_bcache_put(body_cache_t *bcache, const char *id, int tmp)
     /* clean up leftover tmp file */
     mutt_unlink (path);
 
-  s = strchr (path + 1, '/');
-  while (!(fp = safe_fopen (path, "w+")) && errno == ENOENT && s)
-  {
-    /* create missing path components */
-    *s = '\0';
-    if (stat (path, &sb) < 0 && (errno != ENOENT || mkdir (path, 0777) < 0))
-      return NULL;
-    *s = '/';
-    s = strchr (s + 1, '/');
-  }
+  /* create missing path components */
+  if (bcache_mkdir (path) < 0 || !(fp = safe_fopen (path, "w+")))
+    return NULL;
 
   out:
   dprint (3, (debugfile, "bcache: put: '%s'\n", path));
@@ -165,27 +848,70 @@ FILE* mutt_bcache_put(body_cache_t *bcache, const char *id, int tmp)
 
 int mutt_bcache_commit(body_cache_t* bcache, const char* id)
 {
-  char tmpid[_POSIX_PATH_MAX];
+  char path[_POSIX_PATH_MAX];
+  char newpath[_POSIX_PATH_MAX];
+  struct stat sb;
+
+  if (!bcache || !id || !*id)
+    return -1;
+
+  bcache_file (bcache, id, ".tmp", path, sizeof (path));
+  bcache_file (bcache, id, NULL, newpath, sizeof (newpath));
+
+  dprint (3, (debugfile, "bcache: commit: '%s'\n", newpath));
+
+#ifdef USE_ZLIB
+  if (option (OPTMESSAGECACHECOMPRESS))
+  {
+    char zpath[_POSIX_PATH_MAX];
+
+    /* keep the plain file if compressing fails */
+    bcache_file (bcache, id, ".gz.tmp", zpath, sizeof (zpath));
+    mutt_unlink (zpath);
+    if (bcache_compress (path, zpath) == 0)
+    {
+      unlink (path);
+      strfcpy (path, zpath, sizeof (path));
+    }
+  }
+#endif
+
+  if (rename (path, newpath) < 0)
+    return -1;
 
-  snprintf (tmpid, sizeof (tmpid), "%s.tmp", id);
+  if (stat (newpath, &sb) == 0)
+  {
+    index_log ('+', newpath, sb.st_size);
+    index_evict (newpath);
+  }
 
-  return mutt_bcache_move (bcache, tmpid, id);
+  return 0;
 }
 
 int mutt_bcache_move(body_cache_t* bcache, const char* id, const char* newid)
 {
   char path[_POSIX_PATH_MAX];
   char newpath[_POSIX_PATH_MAX];
+  BCACHE_ENTRY *e;
+  long size;
 
   if (!bcache || !id || !*id || !newid || !*newid)
     return -1;
 
-  snprintf (path, sizeof (path), "%s%s", bcache->path, id);
-  snprintf (newpath, sizeof (newpath), "%s%s", bcache->path, newid);
+  bcache_file (bcache, id, NULL, path, sizeof (path));
+  bcache_file (bcache, newid, NULL, newpath, sizeof (newpath));
 
   dprint (3, (debugfile, "bcache: mv: '%s' '%s'\n", path, newpath));
 
-  return rename (path, newpath);
+  if (bcache_mkdir (newpath) < 0 || rename (path, newpath) < 0)
+    return -1;
+
+  e = Index.hash ? hash_find (Index.hash, path + bcache->rootlen) : NULL;
+  size = e ? e->size : 0;
+  index_log ('-', path, 0);
+  index_log ('+', newpath, size);
+
+  return 0;
 }
 
 int mutt_bcache_del(body_cache_t *bcache, const char *id)
@@ -195,29 +921,35 @@ int mutt_bcache_del(body_cache_t *bcache, const char *id)
   if (!id || !*id || !bcache)
     return -1;
 
-  path[0] = '\0';
-  safe_strncat (path, sizeof (path), bcache->path, bcache->pathlen);
-  safe_strncat (path, sizeof (path), id, mutt_strlen (id));
+  bcache_file (bcache, id, NULL, path, sizeof (path));
 
   dprint (3, (debugfile, "bcache: del: '%s'\n", path));
 
+  index_log ('-', path, 0);
+
   return unlink (path);
 }
 
 int mutt_bcache_exists(body_cache_t *bcache, const char *id)
 {
   char path[_POSIX_PATH_MAX];
+  BCACHE_ENTRY *e;
   struct stat st;
   int rc = 0;
 
   if (!id || !*id || !bcache)
     return -1;
 
-  path[0] = '\0';
-  safe_strncat (path, sizeof (path), bcache->path, bcache->pathlen);
-  safe_strncat (path, sizeof (path), id, mutt_strlen (id));
+  bcache_file (bcache, id, NULL, path, sizeof (path));
 
-  if (stat (path, &st) < 0)
+  /* the index knows without touching the disk; only fall back to stat()
+   * if it couldn't be opened */
+  if (Index.fp && !mutt_strncmp (path, Index.root, bcache->rootlen))
+  {
+    e = hash_find (Index.hash, path + bcache->rootlen);
+    rc = e && e->size != 0 ? 0 : -1;
+  }
+  else if (stat (path, &st) < 0)
     rc = -1;
   else
     rc = S_ISREG(st.st_mode) && st.st_size != 0 ? 0 : -1;
@@ -227,13 +959,48 @@ int mutt_bcache_exists(body_cache_t *bcache, const char *id)
   return rc;
 }
 
+/* call want_id for the files in one shard directory */
+static int bcache_list_shard (body_cache_t *bcache, const char *shard,
+			      int (*want_id)(const char *id, body_cache_t *bcache,
+					     void *data), void *data)
+{
+  char path[_POSIX_PATH_MAX];
+  DIR *d;
+  struct dirent *de;
+  int rc = 0;
+
+  snprintf (path, sizeof (path), "%s%s", bcache->path, shard);
+  if (!(d = opendir (path)))
+    return 0;
+
+  while ((de = readdir (d)))
+  {
+    if (mutt_strncmp (de->d_name, ".", 1) == 0 ||
+	mutt_strncmp (de->d_name, "..", 2) == 0)
+      continue;
+
+    dprint (3, (debugfile, "bcache: list: dir: '%s', id :'%s'\n", path, de->d_name));
+
+    if (want_id && want_id (de->d_name, bcache, data) != 0)
+    {
+      rc = -1;
+      break;
+    }
+
+    rc++;
+  }
+
+  closedir (d);
+  return rc;
+}
+
 int mutt_bcache_list(body_cache_t *bcache,
 		     int (*want_id)(const char *id, body_cache_t *bcache,
 				    void *data), void *data)
 {
   DIR *d = NULL;
   struct dirent *de;
-  int rc = -1;
+  int n, rc = -1;
 
   if (!bcache || !(d = opendir (bcache->path)))
     goto out;
@@ -242,18 +1009,17 @@ int mutt_bcache_list(body_cache_t *bcache,
 
   dprint (3, (debugfile, "bcache: list: dir: '%s'\n", bcache->path));
 
+  /* messages only live in the shard directories; the others belong to
+   * subfolders */
   while ((de = readdir (d)))
   {
-    if (mutt_strncmp (de->d_name, ".", 1) == 0 ||
-	mutt_strncmp (de->d_name, "..", 2) == 0)
+    if (!bcache_is_shard (de->d_name))
       continue;
 
-    dprint (3, (debugfile, "bcache: list: dir: '%s', id :'%s'\n", bcache->path, de->d_name));
-
-    if (want_id && want_id (de->d_name, bcache, data) != 0)
+    if ((n = bcache_list_shard (bcache, de->d_name, want_id, data)) < 0)
       goto out;
 
-    rc++;
+    rc += n;
   }
 
 out:
@@ -409,7 +409,12 @@ int mutt_buffy_check (int force)
   if (!Incoming)
     return 0;
   t = time (NULL);
-  if (!force && (t - BuffyTime < BuffyTimeout))
+  if (!force && (t - BuffyTime < BuffyTimeout)
+#ifdef USE_IMAP
+      /* don't sit on changes an IMAP server has pushed */
+      && !imap_buffy_pending ()
+#endif
+      )
     return BuffyCount;
  
   BuffyTime = t;
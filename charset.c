@@ -346,6 +346,93 @@ int iconv_close (iconv_t cd)
 #endif /* !HAVE_ICONV */
 
 
+/*
+ * Opening a conversion descriptor is expensive with most iconv
+ * implementations, and header decoding asks for the same handful of
+ * conversions over and over.  Keep a small pool of descriptors keyed
+ * by the names we finally hand to iconv_open() (that is, after
+ * canonicalisation and all hooks have been applied), so changing the
+ * hooks never returns a stale conversion.  A descriptor is lent to
+ * one caller at a time; mutt_iconv_close() gives it back.
+ */
+
+#define ICONV_CACHE_SIZE 16
+
+static struct
+{
+  char *tocode;
+  char *fromcode;
+  iconv_t cd;
+  unsigned int used;	/* LRU stamp */
+  short busy;		/* lent out by mutt_iconv_open() */
+} IconvCache[ICONV_CACHE_SIZE];
+
+static unsigned int IconvCacheClock;
+static unsigned int IconvCacheHits, IconvCacheMisses;
+
+static iconv_t iconv_cache_get (const char *tocode, const char *fromcode)
+{
+  int i;
+
+  for (i = 0; i < ICONV_CACHE_SIZE; i++)
+  {
+    if (!IconvCache[i].tocode || IconvCache[i].busy ||
+	mutt_strcmp (IconvCache[i].tocode, tocode) ||
+	mutt_strcmp (IconvCache[i].fromcode, fromcode))
+      continue;
+
+    /* return to the initial shift state before handing it out again */
+    iconv (IconvCache[i].cd, 0, 0, 0, 0);
+    IconvCache[i].busy = 1;
+    IconvCache[i].used = ++IconvCacheClock;
+    IconvCacheHits++;
+    return IconvCache[i].cd;
+  }
+
+  IconvCacheMisses++;
+  dprint (3, (debugfile, "iconv_cache_get: miss for %s -> %s (%u hits, %u misses)\n",
+	      fromcode, tocode, IconvCacheHits, IconvCacheMisses));
+  return (iconv_t) -1;
+}
+
+/* Adds a freshly opened descriptor, evicting the least recently used
+ * idle one if the pool is full.  If every slot is lent out the
+ * descriptor simply stays uncached. */
+static void iconv_cache_put (const char *tocode, const char *fromcode, iconv_t cd)
+{
+  int i, victim = -1;
+
+  for (i = 0; i < ICONV_CACHE_SIZE; i++)
+  {
+    if (IconvCache[i].busy)
+      continue;
+    if (!IconvCache[i].tocode)
+    {
+      victim = i;
+      break;
+    }
+    if (victim < 0 || IconvCache[i].used < IconvCache[victim].used)
+      victim = i;
+  }
+
+  if (victim < 0)
+    return;
+
+  if (IconvCache[victim].tocode)
+  {
+    iconv_close (IconvCache[victim].cd);
+    FREE (&IconvCache[victim].tocode);
+    FREE (&IconvCache[victim].fromcode);
+  }
+
+  IconvCache[victim].tocode = safe_strdup (tocode);
+  IconvCache[victim].fromcode = safe_strdup (fromcode);
+  IconvCache[victim].cd = cd;
+  IconvCache[victim].used = ++IconvCacheClock;
+  IconvCache[victim].busy = 1;
+}
+
+
 /*
  * Like iconv_open, but canonicalises the charsets, applies
  * charset-hooks, recanonicalises, and finally applies iconv-hooks.
@@ -385,13 +472,43 @@ iconv_t mutt_iconv_open (const char *tocode, const char *fromcode, int flags)
   fromcode2 = mutt_iconv_hook (fromcode1);
   fromcode2 = (fromcode2) ? fromcode2 : fromcode1;
 
+  /* reuse an idle descriptor for the same conversion if we have one */
+  if ((cd = iconv_cache_get (tocode2, fromcode2)) != (iconv_t) -1)
+    return cd;
+
   /* call system iconv with names it appreciates */
   if ((cd = iconv_open (tocode2, fromcode2)) != (iconv_t) -1)
+  {
+    iconv_cache_put (tocode2, fromcode2, cd);
     return cd;
+  }
   
   return (iconv_t) -1;
 }
 
+/*
+ * Releases a descriptor obtained from mutt_iconv_open().  Cached
+ * descriptors are kept open for the next caller; everything else
+ * is closed.
+ */
+
+void mutt_iconv_close (iconv_t cd)
+{
+  int i;
+
+  if (cd == (iconv_t) -1)
+    return;
+
+  for (i = 0; i < ICONV_CACHE_SIZE; i++)
+    if (IconvCache[i].busy && IconvCache[i].cd == cd)
+    {
+      IconvCache[i].busy = 0;
+      return;
+    }
+
+  iconv_close (cd);
+}
+
 
 /*
  * Like iconv, but keeps going even when the input is invalid
@@ -503,7 +620,7 @@ int mutt_convert_string (char **ps, const char *from, const char *to, int flags)
     ob = buf = safe_malloc (obl + 1);
     
     mutt_iconv (cd, &ib, &ibl, &ob, &obl, inrepls, outrepl);
-    iconv_close (cd);
+    mutt_iconv_close (cd);
 
     *ob = '\0';
 
@@ -649,7 +766,7 @@ void fgetconv_close (FGETCONV **_fc)
   struct fgetconv_s *fc = (struct fgetconv_s *) *_fc;
 
   if (fc->cd != (iconv_t)-1)
-    iconv_close (fc->cd);
+    mutt_iconv_close (fc->cd);
   FREE (_fc);		/* __FREE_CHECKED__ */
 }
 
@@ -671,7 +788,7 @@ int mutt_check_charset (const char *s, int strict)
 
   if ((cd = mutt_iconv_open (s, s, 0)) != (iconv_t)(-1))
   {
-    iconv_close (cd);
+    mutt_iconv_close (cd);
     return 0;
   }
 
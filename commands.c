@@ -846,19 +846,55 @@ int mutt_save_message (HEADER *h, int delete,
     }
     else
     {
+      int batch = 0;
+
+#ifdef USE_IMAP
+      /* upload the messages together if the server allows it. They reach
+       * the server only at imap_append_commit, so don't delete any of them
+       * before that has succeeded. */
+      if (ctx.magic == M_IMAP)
+        batch = (imap_append_begin (&ctx) == 0);
+#endif
+
       for (i = 0; i < Context->vcount; i++)
       {
 	if (Context->hdrs[Context->v2r[i]]->tagged)
 	{
 	  mutt_message_hook (Context, Context->hdrs[Context->v2r[i]], M_MESSAGEHOOK);
 	  if (_mutt_save_message(Context->hdrs[Context->v2r[i]],
-			     &ctx, delete, decode, decrypt) != 0)
+			     &ctx, batch ? 0 : delete, decode, decrypt) != 0)
           {
+#ifdef USE_IMAP
+            if (batch)
+              imap_append_commit (&ctx);
+#endif
             mx_close_mailbox (&ctx, NULL);
             return -1;
           }
 	}
       }
+
+#ifdef USE_IMAP
+      if (batch)
+      {
+        if (imap_append_commit (&ctx) != 0)
+        {
+          mx_close_mailbox (&ctx, NULL);
+          return -1;
+        }
+
+        for (i = 0; delete && i < Context->vcount; i++)
+        {
+          h = Context->hdrs[Context->v2r[i]];
+          if (h->tagged)
+          {
+            mutt_set_flag (Context, h, M_DELETE, 1);
+            if (option (OPTDELETEUNTAG))
+              mutt_set_flag (Context, h, M_TAG, 0);
+          }
+        }
+      }
+#endif
     }
 
     need_buffy_cleanup = (ctx.magic == M_MBOX || ctx.magic == M_MMDF);
@@ -60,6 +60,7 @@ WHERE char *Hostname;
 WHERE char *ImapAuthenticators INITVAL (NULL);
 WHERE char *ImapDelimChars INITVAL (NULL);
 WHERE char *ImapHeaders;
+WHERE REGEXP ImapIdleMailboxes;
 WHERE char *ImapLogin INITVAL (NULL);
 WHERE char *ImapPass INITVAL (NULL);
 WHERE char *ImapUser INITVAL (NULL);
@@ -71,6 +72,7 @@ WHERE char *MailcapPath;
 WHERE char *Maildir;
 #if defined(USE_IMAP) || defined(USE_POP)
 WHERE char *MessageCachedir;
+WHERE short MessageCacheSize;
 #endif
 #if USE_HCACHE
 WHERE char *HeaderCache;
@@ -104,6 +106,7 @@ WHERE char *PopAuthenticators INITVAL (NULL);
 WHERE short PopCheckTimeout;
 WHERE char *PopHost;
 WHERE char *PopPass INITVAL (NULL);
+WHERE short PopPipelineDepth;
 WHERE char *PopUser INITVAL (NULL);
 #endif
 WHERE char *PostIndentString;
@@ -214,8 +217,16 @@ WHERE short ScoreThresholdRead;
 WHERE short ScoreThresholdFlag;
 
 #ifdef USE_IMAP
+WHERE short ImapFetchChunkSize;
 WHERE short ImapKeepalive;
 WHERE short ImapPipelineDepth;
+WHERE short ImapPollTimeout;
+WHERE short ImapPrefetchCount;
+WHERE short ImapPrefetchSize;
+#endif
+
+#ifdef USE_SMTP
+WHERE short SmtpSessionTimeout;
 #endif
 
 /* flags for received signals */
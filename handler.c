@@ -182,6 +182,18 @@ static void qp_decode_line (char *dest, char *src, size_t *l,
   
   for (d = dest, s = src; *s;)
   {
+    /* copy everything up to the next '=' in one go */
+    if (*s != '=')
+    {
+      size_t n = strcspn (s, "=");
+
+      memcpy (d, s, n);
+      d += n;
+      s += n;
+      kind = -1;
+      continue;
+    }
+
     switch ((kind = qp_decode_triple (s, &c)))
     {
       case  0: *d++ = c; s += 3; break;	/* qp triple */
@@ -283,10 +295,15 @@ static void mutt_decode_quoted (STATE *s, long len, int istext, iconv_t cd)
   state_reset_prefix(s);
 }
 
+/* true if ch is one of the 64 base64 digits (not the '=' pad) */
+#define B64_DIGIT(ch) ((ch) < 128 && base64val (ch) != -1)
+
 void mutt_decode_base64 (STATE *s, long len, int istext, iconv_t cd)
 {
   char buf[5];
-  int c1, c2, c3, c4, ch, cr = 0, i;
+  int c1, c2, c3, c4, ch, cr = 0, i = 0, n, o, k, done = 0;
+  unsigned char bufin[BUFO_SIZE], *p, *end;
+  char bufo[3];
   char bufi[BUFI_SIZE];
   size_t l = 0;
 
@@ -295,70 +312,94 @@ void mutt_decode_base64 (STATE *s, long len, int istext, iconv_t cd)
   if (istext) 
     state_set_prefix(s);
 
-  while (len > 0)
+  while (len > 0 && !done)
   {
-    for (i = 0 ; i < 4 && len > 0 ; len--)
-    {
-      if ((ch = fgetc (s->fpin)) == EOF)
-	break;
-      if (ch >= 0 && ch < 128 && (base64val(ch) != -1 || ch == '='))
-	buf[i++] = ch;
-    }
-    if (i != 4)
-    {
-      /* "i" may be zero if there is trailing whitespace, which is not an error */
-      if (i != 0)
-	dprint (2, (debugfile, "%s:%d [mutt_decode_base64()]: "
-	      "didn't get a multiple of 4 chars.\n", __FILE__, __LINE__));
+    if ((n = fread (bufin, 1, MIN (len, (long) sizeof (bufin)), s->fpin)) <= 0)
       break;
-    }
-
-    c1 = base64val (buf[0]);
-    c2 = base64val (buf[1]);
-    ch = (c1 << 2) | (c2 >> 4);
-
-    if (cr && ch != '\n') 
-      bufi[l++] = '\r';
-
-    cr = 0;
-      
-    if (istext && ch == '\r')
-      cr = 1;
-    else
-      bufi[l++] = ch;
+    len -= n;
 
-    if (buf[2] == '=')
-      break;
-    c3 = base64val (buf[2]);
-    ch = ((c2 & 0xf) << 4) | (c3 >> 2);
-
-    if (cr && ch != '\n')
-      bufi[l++] = '\r';
+    for (p = bufin, end = bufin + n; p < end && !done; )
+    {
+      /* 
+       * Well-formed input is almost entirely runs of complete quads;
+       * decode those straight from the read buffer and only fall back
+       * to collecting digits one at a time around line breaks, stray
+       * characters and the final padding.
+       */
+      if (i == 0 && end - p >= 4 && B64_DIGIT (p[0]) && B64_DIGIT (p[1])
+	  && B64_DIGIT (p[2]) && B64_DIGIT (p[3]))
+      {
+	c1 = base64val (p[0]);
+	c2 = base64val (p[1]);
+	c3 = base64val (p[2]);
+	c4 = base64val (p[3]);
+	p += 4;
+	bufo[0] = (c1 << 2) | (c2 >> 4);
+	bufo[1] = ((c2 & 0xf) << 4) | (c3 >> 2);
+	bufo[2] = ((c3 & 0x3) << 6) | c4;
+	o = 3;
+      }
+      else
+      {
+	ch = *p++;
+	if (!B64_DIGIT (ch) && ch != '=')
+	  continue;
+	buf[i++] = ch;
+	if (i < 4)
+	  continue;
+	i = 0;
+
+	c1 = base64val (buf[0]);
+	c2 = base64val (buf[1]);
+	bufo[0] = (c1 << 2) | (c2 >> 4);
+	o = 1;
+	if (buf[2] == '=')
+	  done = 1;
+	else
+	{
+	  c3 = base64val (buf[2]);
+	  bufo[o++] = ((c2 & 0xf) << 4) | (c3 >> 2);
+	  if (buf[3] == '=')
+	    done = 1;
+	  else
+	  {
+	    c4 = base64val (buf[3]);
+	    bufo[o++] = ((c3 & 0x3) << 6) | c4;
+	  }
+	}
+      }
 
-    cr = 0;
+      if (!istext)
+      {
+	memcpy (bufi + l, bufo, o);
+	l += o;
+      }
+      else
+	for (k = 0; k < o; k++)
+	{
+	  ch = (unsigned char) bufo[k];
 
-    if (istext && ch == '\r')
-      cr = 1;
-    else
-      bufi[l++] = ch;
+	  if (cr && ch != '\n')
+	    bufi[l++] = '\r';
 
-    if (buf[3] == '=') break;
-    c4 = base64val (buf[3]);
-    ch = ((c3 & 0x3) << 6) | c4;
+	  cr = 0;
 
-    if (cr && ch != '\n')
-      bufi[l++] = '\r';
-    cr = 0;
+	  if (ch == '\r')
+	    cr = 1;
+	  else
+	    bufi[l++] = ch;
+	}
 
-    if (istext && ch == '\r')
-      cr = 1;
-    else
-      bufi[l++] = ch;
-    
-    if (l + 8 >= sizeof (bufi))
-      mutt_convert_to_state (cd, bufi, &l, s);
+      if (l + 8 >= sizeof (bufi))
+	mutt_convert_to_state (cd, bufi, &l, s);
+    }
   }
 
+  /* "i" may be zero if there is trailing whitespace, which is not an error */
+  if (i != 0 && !done)
+    dprint (2, (debugfile, "%s:%d [mutt_decode_base64()]: "
+		"didn't get a multiple of 4 chars.\n", __FILE__, __LINE__));
+
   if (cr) bufi[l++] = '\r';
 
   mutt_convert_to_state (cd, bufi, &l, s);
@@ -1560,7 +1601,7 @@ void mutt_decode_attachment (BODY *b, STATE *s)
   }
 
   if (cd != (iconv_t)(-1))
-    iconv_close (cd);
+    mutt_iconv_close (cd);
 }
 
 /* when generating format=flowed ($text_flowed is set) from format=fixed,
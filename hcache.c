@@ -644,6 +644,9 @@ mutt_hcache_dump(header_cache_t *h, HEADER * header, int *off,
   nh.path = NULL;
   nh.tree = NULL;
   nh.thread = NULL;
+  nh.score_cache = NULL;
+  nh.score_gen = 0;
+  nh.score_slots = 0;
 #ifdef MIXMASTER
   nh.chain = NULL;
 #endif
@@ -23,6 +23,7 @@
 #include "mutt.h"
 #include "mailbox.h"
 #include "mutt_crypt.h"
+#include "hash.h"
 
 #include <limits.h>
 #include <string.h>
@@ -36,13 +37,49 @@ typedef struct hook
   REGEXP rx;		/* regular expression */
   char *command;	/* filename, command or pattern to execute */
   pattern_t *pattern;	/* used for fcc,save,send-hook */
+  int seq;		/* position in the list of hooks */
+  unsigned int mark;	/* candidate stamp, see hook_candidates() */
   struct hook *next;
 } HOOK;
 
 static HOOK *Hooks = NULL;
+static int HookSeq = 0;
 
 static int current_hook_type = 0;
 
+/* Hooks taking a pattern are indexed so that a message only evaluates the
+ * hooks which can possibly match it.  Most of these patterns require some
+ * literal string in an address or the subject (e.g. "~f joe@example\.com"),
+ * so each such hook is filed under one HOOK_GRAM long piece of that literal.
+ * A message collects candidates by looking up every piece of its addresses
+ * and subject; the remaining hooks are always candidates.  Hooks which are
+ * skipped this way cannot match, so the outcome is the same as evaluating
+ * all hooks in order.
+ */
+#define HOOK_GRAM 3
+
+#define M_PATTERNHOOK (M_SENDHOOK | M_SEND2HOOK | M_SAVEHOOK | M_FCCHOOK | \
+		       M_MESSAGEHOOK | M_REPLYHOOK)
+
+typedef struct hook_gram
+{
+  char key[HOOK_GRAM + 1];
+  HOOK *hook;
+} HOOK_GRAM_T;
+
+static HASH *HookIndex = NULL;
+static HOOK **HookUnindexed = NULL;
+static int HookUnindexedCount = 0;
+static int HookIndexValid = 0;
+static unsigned int HookGen = 0;	/* bumped whenever Hooks changes */
+static unsigned int HookStamp = 0;
+
+static void hook_index_invalidate (void)
+{
+  HookIndexValid = 0;
+  HookGen++;
+}
+
 int mutt_parse_hook (BUFFER *buf, BUFFER *s, unsigned long data, BUFFER *err)
 {
   HOOK *ptr;
@@ -164,6 +201,7 @@ int mutt_parse_hook (BUFFER *buf, BUFFER *s, unsigned long data, BUFFER *err)
 	FREE (&ptr->command);
 	ptr->command = command.data;
 	FREE (&pattern.data);
+	hook_index_invalidate ();
 	return 0;
       }
     }
@@ -207,6 +245,8 @@ int mutt_parse_hook (BUFFER *buf, BUFFER *s, unsigned long data, BUFFER *err)
   ptr->rx.pattern = pattern.data;
   ptr->rx.rx = rx;
   ptr->rx.not = not;
+  ptr->seq = HookSeq++;
+  hook_index_invalidate ();
   return 0;
 
 error:
@@ -233,6 +273,8 @@ static void delete_hooks (int type)
   HOOK *h;
   HOOK *prev;
 
+  hook_index_invalidate ();
+
   while (h = Hooks, h && (type == 0 || type == h->type))
   {
     Hooks = h->next;
@@ -344,10 +386,249 @@ char *mutt_find_hook (int type, const char *pat)
   return (NULL);
 }
 
+static int hook_list_len (LIST *l)
+{
+  int n;
+
+  for (n = 0; l; l = l->next)
+    n++;
+  return n;
+}
+
+/* Collect into lits the literals of which a message matching pat must
+ * contain at least one in an address or its subject.  Returns -1 if no
+ * such set is known.
+ */
+static int hook_literals (const pattern_t *pat, LIST **lits)
+{
+  const pattern_t *p;
+  LIST *best = NULL, *tmp;
+  int rc = -1;
+
+  if (pat->not)
+    return -1;
+
+  switch (pat->op)
+  {
+    case M_FROM:
+    case M_SENDER:
+    case M_TO:
+    case M_CC:
+    case M_ADDRESS:
+    case M_RECIPIENT:
+    case M_SUBJECT:
+      if (pat->alladdr || pat->groupmatch ||
+	  mutt_strlen (pat->literal) < HOOK_GRAM)
+	return -1;
+      *lits = mutt_add_list (*lits, pat->literal);
+      return 0;
+
+    case M_AND:
+      /* any conjunct will do, prefer the one with the fewest literals */
+      for (p = pat->child; p; p = p->next)
+      {
+	tmp = NULL;
+	if (hook_literals (p, &tmp) == 0 &&
+	    (rc < 0 || hook_list_len (tmp) < hook_list_len (best)))
+	{
+	  mutt_free_list (&best);
+	  best = tmp;
+	  rc = 0;
+	}
+	else
+	  mutt_free_list (&tmp);
+      }
+      break;
+
+    case M_OR:
+      /* every alternative needs a literal */
+      for (p = pat->child; p; p = p->next)
+      {
+	if (hook_literals (p, &best) < 0)
+	{
+	  mutt_free_list (&best);
+	  return -1;
+	}
+      }
+      rc = 0;
+      break;
+  }
+
+  if (rc == 0)
+  {
+    for (tmp = best; tmp; tmp = tmp->next)
+      *lits = mutt_add_list (*lits, tmp->data);
+    mutt_free_list (&best);
+  }
+  return rc;
+}
+
+static int hook_gram_count (const char *key)
+{
+  struct hash_elem *elem;
+  int n = 0;
+
+  elem = HookIndex->table[HookIndex->hash_string ((unsigned char *) key,
+						  HookIndex->nelem)];
+  for (; elem; elem = elem->next)
+    if (!HookIndex->cmp_string (key, elem->key))
+      n++;
+  return n;
+}
+
+static void hook_gram_free (void *p)
+{
+  FREE (&p);
+}
+
+/* file hook under the least used HOOK_GRAM long piece of lit */
+static void hook_index_literal (HOOK *hook, const char *lit)
+{
+  HOOK_GRAM_T *gram = safe_calloc (1, sizeof (HOOK_GRAM_T));
+  char key[HOOK_GRAM + 1];
+  int i, n, best = -1;
+
+  gram->hook = hook;
+  for (i = 0; lit[i + HOOK_GRAM - 1]; i++)
+  {
+    strfcpy (key, lit + i, sizeof (key));
+    n = hook_gram_count (key);
+    if (best < 0 || n < best)
+    {
+      strfcpy (gram->key, key, sizeof (gram->key));
+      if ((best = n) == 0)
+	break;
+    }
+  }
+  hash_insert (HookIndex, gram->key, gram, 1);
+}
+
+static void hook_index_build (void)
+{
+  HOOK *hook;
+  LIST *lits, *l;
+  int n = 0;
+
+  if (HookIndex)
+    hash_destroy (&HookIndex, hook_gram_free);
+  HookUnindexedCount = 0;
+
+  for (hook = Hooks; hook; hook = hook->next)
+    n++;
+  HookIndex = hash_create (MAX (2 * n, 31), 1);
+  safe_realloc (&HookUnindexed, MAX (n, 1) * sizeof (HOOK *));
+
+  for (hook = Hooks; hook; hook = hook->next)
+  {
+    if (!(hook->type & M_PATTERNHOOK) || !hook->pattern)
+      continue;
+
+    lits = NULL;
+    if (!hook->rx.not && hook_literals (hook->pattern, &lits) == 0)
+    {
+      for (l = lits; l; l = l->next)
+	hook_index_literal (hook, l->data);
+    }
+    else
+      HookUnindexed[HookUnindexedCount++] = hook;
+    mutt_free_list (&lits);
+  }
+
+  HookIndexValid = 1;
+}
+
+static void hook_mark_grams (const char *s, int type, HOOK **cand, int *n)
+{
+  struct hash_elem *elem;
+  HOOK_GRAM_T *gram;
+  char key[HOOK_GRAM + 1];
+  size_t i, len = mutt_strlen (s);
+
+  for (i = 0; i + HOOK_GRAM <= len; i++)
+  {
+    strfcpy (key, s + i, sizeof (key));
+    elem = HookIndex->table[HookIndex->hash_string ((unsigned char *) key,
+						    HookIndex->nelem)];
+    for (; elem; elem = elem->next)
+    {
+      gram = (HOOK_GRAM_T *) elem->data;
+      if (gram->hook->mark != HookStamp && (gram->hook->type & type) &&
+	  !HookIndex->cmp_string (key, elem->key))
+      {
+	gram->hook->mark = HookStamp;
+	cand[(*n)++] = gram->hook;
+      }
+    }
+  }
+}
+
+static void hook_mark_addresses (ADDRESS *a, int type, HOOK **cand, int *n)
+{
+  for (; a; a = a->next)
+  {
+    hook_mark_grams (a->mailbox, type, cand, n);
+    hook_mark_grams (a->personal, type, cand, n);
+  }
+}
+
+static int hook_seq_cmp (const void *a, const void *b)
+{
+  return (*(HOOK **) a)->seq - (*(HOOK **) b)->seq;
+}
+
+/* Returns the hooks of the given type which might match hdr, in the order
+ * they were defined.  The caller must free the array.
+ */
+static HOOK **hook_candidates (HEADER *hdr, int type, int *n)
+{
+  HOOK **cand;
+  HOOK *hook;
+  int i, max = 0;
+
+  if (!HookIndexValid)
+    hook_index_build ();
+
+  for (hook = Hooks; hook; hook = hook->next)
+    max++;
+  cand = safe_malloc (MAX (max, 1) * sizeof (HOOK *));
+  *n = 0;
+
+  HookStamp++;
+  for (i = 0; i < HookUnindexedCount; i++)
+    if (HookUnindexed[i]->type & type)
+    {
+      HookUnindexed[i]->mark = HookStamp;
+      cand[(*n)++] = HookUnindexed[i];
+    }
+
+  if (hdr->env)
+  {
+    hook_mark_addresses (hdr->env->from, type, cand, n);
+    hook_mark_addresses (hdr->env->sender, type, cand, n);
+    hook_mark_addresses (hdr->env->to, type, cand, n);
+    hook_mark_addresses (hdr->env->cc, type, cand, n);
+    hook_mark_grams (hdr->env->subject, type, cand, n);
+  }
+
+  qsort (cand, *n, sizeof (HOOK *), hook_seq_cmp);
+  return cand;
+}
+
+static int run_message_hook (HOOK *hook, CONTEXT *ctx, HEADER *hdr,
+			     BUFFER *token, BUFFER *err)
+{
+  if (hook->command &&
+      (mutt_pattern_exec (hook->pattern, 0, ctx, hdr) > 0) ^ hook->rx.not)
+    return mutt_parse_rc_line (hook->command, token, err);
+  return 0;
+}
+
 void mutt_message_hook (CONTEXT *ctx, HEADER *hdr, int type)
 {
   BUFFER err, token;
-  HOOK *hook;
+  HOOK *hook, **cand;
+  unsigned int gen;
+  int i, n, rc = 0;
 
   current_hook_type = type;
 
@@ -355,23 +636,30 @@ void mutt_message_hook (CONTEXT *ctx, HEADER *hdr, int type)
   err.dsize = STRING;
   err.data = safe_malloc (err.dsize);
   mutt_buffer_init (&token);
-  for (hook = Hooks; hook; hook = hook->next)
+
+  cand = hook_candidates (hdr, type, &n);
+  gen = HookGen;
+  for (i = 0; i < n && rc == 0; i++)
   {
-    if(!hook->command)
-      continue;
+    hook = cand[i];
+    rc = run_message_hook (hook, ctx, hdr, &token, &err);
 
-    if (hook->type & type)
-      if ((mutt_pattern_exec (hook->pattern, 0, ctx, hdr) > 0) ^ hook->rx.not)
-	if (mutt_parse_rc_line (hook->command, &token, &err) != 0)
-	{
-	  FREE (&token.data);
-	  mutt_error ("%s", err.data);
-	  mutt_sleep (1);
-	  current_hook_type = 0;
-	  FREE (&err.data);
+    if (rc == 0 && gen != HookGen)
+    {
+      /* the command changed the hooks, so the candidates may be stale.
+       * continue the way it would have been done without the index. */
+      for (hook = hook->next; hook && rc == 0; hook = hook->next)
+	if (hook->type & type)
+	  rc = run_message_hook (hook, ctx, hdr, &token, &err);
+      break;
+    }
+  }
+  FREE (&cand);
 
-	  return;
-	}
+  if (rc != 0)
+  {
+    mutt_error ("%s", err.data);
+    mutt_sleep (1);
   }
   FREE (&token.data);
   FREE (&err.data);
@@ -382,22 +670,27 @@ void mutt_message_hook (CONTEXT *ctx, HEADER *hdr, int type)
 static int
 mutt_addr_hook (char *path, size_t pathlen, int type, CONTEXT *ctx, HEADER *hdr)
 {
-  HOOK *hook;
+  HOOK *hook, **cand;
+  int i, n;
+
+  cand = hook_candidates (hdr, type, &n);
 
   /* determine if a matching hook exists */
-  for (hook = Hooks; hook; hook = hook->next)
+  for (i = 0; i < n; i++)
   {
+    hook = cand[i];
     if(!hook->command)
       continue;
 
-    if (hook->type & type)
-      if ((mutt_pattern_exec (hook->pattern, 0, ctx, hdr) > 0) ^ hook->rx.not)
-      {
-	mutt_make_string (path, pathlen, hook->command, ctx, hdr);
-	return 0;
-      }
+    if ((mutt_pattern_exec (hook->pattern, 0, ctx, hdr) > 0) ^ hook->rx.not)
+    {
+      FREE (&cand);
+      mutt_make_string (path, pathlen, hook->command, ctx, hdr);
+      return 0;
+    }
   }
 
+  FREE (&cand);
   return -1;
 }
 
@@ -31,7 +31,14 @@
 #include "buffy.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <stdlib.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
 
 #define IMAP_CMD_BUFSIZE 512
 
@@ -50,8 +57,10 @@ static void cmd_parse_lsub (IMAP_DATA* idata, char* s);
 static void cmd_parse_fetch (IMAP_DATA* idata, char* s);
 static void cmd_parse_myrights (IMAP_DATA* idata, const char* s);
 static void cmd_parse_search (IMAP_DATA* idata, const char* s);
+static void cmd_parse_esearch (IMAP_DATA* idata, char* s);
 static void cmd_parse_status (IMAP_DATA* idata, char* s);
 static void cmd_parse_enabled (IMAP_DATA* idata, const char* s);
+static void cmd_parse_vanished (IMAP_DATA* idata, char* s);
 
 static const char * const Capabilities[] = {
   "IMAP4",
@@ -67,6 +76,18 @@ static const char * const Capabilities[] = {
   "IDLE",
   "SASL-IR",
   "ENABLE",
+  "CONDSTORE",
+  "QRESYNC",
+  "COMPRESS=DEFLATE",
+  "MULTIAPPEND",
+  "LITERAL+",
+  "LITERAL-",
+  "SORT",
+  "SORT=DISPLAY",
+  "ESEARCH",
+  "LIST-EXTENDED",
+  "LIST-STATUS",
+  "NOTIFY",
 
   NULL
 };
@@ -261,6 +282,101 @@ int imap_exec (IMAP_DATA* idata, const char* cmdstr, int flags)
   return 0;
 }
 
+/* imap_exec_all: send the commands queued on each of n connections, then
+ *   read the responses from whichever connection has data, so one slow
+ *   server doesn't hold up the others. A connection which has been silent
+ *   for timeout seconds (if nonzero) is given up as dead, unless it has a
+ *   mailbox selected: closing that would throw away the user's changes, so
+ *   it is waited for as long as it takes. Returns the number of
+ *   connections which finished their commands. */
+int imap_exec_all (IMAP_DATA** idatas, int n, int timeout)
+{
+  time_t* deadline;
+  time_t now;
+  fd_set rfds;
+  struct timeval tv;
+  int active = 0, done = 0, maxfd, ready, rc, i;
+
+  deadline = safe_calloc (n, sizeof (time_t));
+  now = time (NULL);
+  for (i = 0; i < n; i++)
+  {
+    if (cmd_start (idatas[i], NULL, 0) < 0)
+    {
+      cmd_handle_fatal (idatas[i]);
+      idatas[i] = NULL;
+      continue;
+    }
+    /* no deadline (0) for a connection with a mailbox open */
+    if (timeout && idatas[i]->state < IMAP_SELECTED)
+      deadline[i] = now + timeout;
+    active++;
+  }
+
+  while (active)
+  {
+    /* drain what has already arrived, whole lines at a time */
+    ready = 0;
+    for (i = 0; i < n; i++)
+    {
+      if (!idatas[i] || mutt_socket_poll (idatas[i]->conn) == 0)
+        continue;
+
+      ready = 1;
+      if ((rc = imap_cmd_step (idatas[i])) == IMAP_CMD_CONTINUE)
+      {
+        if (deadline[i])
+          deadline[i] = time (NULL) + timeout;
+        continue;
+      }
+
+      if (rc != IMAP_CMD_BAD || idatas[i]->status != IMAP_FATAL)
+        done++;
+      idatas[i] = NULL;
+      active--;
+    }
+    if (ready)
+      continue;
+
+    FD_ZERO (&rfds);
+    maxfd = -1;
+    now = time (NULL);
+    tv.tv_sec = timeout ? timeout : 60;
+    tv.tv_usec = 0;
+    for (i = 0; i < n; i++)
+    {
+      if (!idatas[i])
+        continue;
+
+      if (deadline[i] && deadline[i] <= now)
+      {
+        dprint (1, (debugfile, "imap_exec_all: %s timed out\n",
+                    idatas[i]->conn->account.host));
+        mutt_error (_("Connection to %s timed out"),
+                    idatas[i]->conn->account.host);
+        cmd_handle_fatal (idatas[i]);
+        idatas[i] = NULL;
+        active--;
+        continue;
+      }
+      if (deadline[i] && deadline[i] - now < tv.tv_sec)
+        tv.tv_sec = deadline[i] - now;
+
+      FD_SET (idatas[i]->conn->fd, &rfds);
+      if (idatas[i]->conn->fd > maxfd)
+        maxfd = idatas[i]->conn->fd;
+    }
+
+    if (maxfd >= 0 && select (maxfd + 1, &rfds, NULL, NULL, &tv) < 0 &&
+        errno != EINTR)
+      break;
+  }
+
+  FREE (&deadline);
+
+  return done;
+}
+
 /* imap_cmd_finish: Attempts to perform cleanup (eg fetch new mail if
  *   detected, do expunge). Called automatically by imap_cmd_step, but
  *   may be called at any time. Called by imap_check_mailbox just before
@@ -508,6 +624,13 @@ static int cmd_handle_untagged (IMAP_DATA* idata)
     else if (ascii_strncasecmp ("FETCH", s, 5) == 0)
       cmd_parse_fetch (idata, pn);
   }
+  else if (idata->watch && isdigit ((unsigned char) *s))
+  {
+    /* EXISTS, EXPUNGE or FETCH in a mailbox watched by imap_buffy_check */
+    dprint (3, (debugfile, "cmd_handle_untagged: activity in %s\n",
+                idata->watch));
+    idata->watchchanged = 1;
+  }
   else if (ascii_strncasecmp ("CAPABILITY", s, 10) == 0)
     cmd_parse_capability (idata, s);
   else if (!ascii_strncasecmp ("OK [CAPABILITY", s, 14))
@@ -522,10 +645,15 @@ static int cmd_handle_untagged (IMAP_DATA* idata)
     cmd_parse_myrights (idata, s);
   else if (ascii_strncasecmp ("SEARCH", s, 6) == 0)
     cmd_parse_search (idata, s);
+  else if (ascii_strncasecmp ("ESEARCH", s, 7) == 0)
+    cmd_parse_esearch (idata, s);
   else if (ascii_strncasecmp ("STATUS", s, 6) == 0)
     cmd_parse_status (idata, s);
   else if (ascii_strncasecmp ("ENABLED", s, 7) == 0)
     cmd_parse_enabled (idata, s);
+  else if ((idata->state >= IMAP_SELECTED) &&
+           ascii_strncasecmp ("VANISHED", s, 8) == 0)
+    cmd_parse_vanished (idata, s);
   else if (ascii_strncasecmp ("BYE", s, 3) == 0)
   {
     dprint (2, (debugfile, "Handling BYE\n"));
@@ -584,30 +712,14 @@ static void cmd_parse_capability (IMAP_DATA* idata, char* s)
   }
 }
 
-/* cmd_parse_expunge: mark headers with new sequence ID and mark idata to
- *   be reopened at our earliest convenience */
+/* cmd_parse_expunge: mark the expunged header and mark idata to be
+ *   reopened at our earliest convenience. The other headers are renumbered
+ *   by imap_msn_compact, once for a whole batch of EXPUNGEs. */
 static void cmd_parse_expunge (IMAP_DATA* idata, const char* s)
 {
-  int expno, cur;
-  HEADER* h;
-
   dprint (2, (debugfile, "Handling EXPUNGE\n"));
 
-  expno = atoi (s);
-
-  /* walk headers, zero seqno of expunged message, decrement seqno of those
-   * above. Possibly we could avoid walking the whole list by resorting
-   * and guessing a good starting point, but I'm guessing the resort would
-   * nullify the gains */
-  for (cur = 0; cur < idata->ctx->msgcount; cur++)
-  {
-    h = idata->ctx->hdrs[cur];
-
-    if (h->index+1 == expno)
-      h->index = -1;
-    else if (h->index+1 > expno)
-      h->index--;
-  }
+  imap_msn_expunge (idata, atoi (s));
 
   idata->reopen |= IMAP_EXPUNGE_PENDING;
 }
@@ -618,29 +730,21 @@ static void cmd_parse_expunge (IMAP_DATA* idata, const char* s)
  *   Of course, a lot of code here duplicates code in message.c. */
 static void cmd_parse_fetch (IMAP_DATA* idata, char* s)
 {
-  int msgno, cur;
-  HEADER* h = NULL;
+  HEADER* h;
 
   dprint (3, (debugfile, "Handling FETCH\n"));
 
-  msgno = atoi (s);
-  
-  if (msgno <= idata->ctx->msgcount)
-  /* see cmd_parse_expunge */
-    for (cur = 0; cur < idata->ctx->msgcount; cur++)
-    {
-      h = idata->ctx->hdrs[cur];
-      
-      if (h && h->active && h->index+1 == msgno)
-      {
-	dprint (2, (debugfile, "Message UID %d updated\n", HEADER_DATA(h)->uid));
-	break;
-      }
-      
-      h = NULL;
-    }
-  
-  if (!h)
+  /* changes reported by SELECT (QRESYNC ...) are applied to the header
+   * cache by imap_read_headers */
+  if (idata->qrdata)
+  {
+    imap_qresync_fetch (idata, s);
+    return;
+  }
+
+  if ((h = imap_msn_get (idata, atoi (s))) && h->active)
+    dprint (2, (debugfile, "Message UID %d updated\n", HEADER_DATA(h)->uid));
+  else
   {
     dprint (3, (debugfile, "FETCH response ignored for this message\n"));
     return;
@@ -657,6 +761,14 @@ static void cmd_parse_fetch (IMAP_DATA* idata, char* s)
   }
   s++;
 
+  /* with CONDSTORE the server may put UID and MODSEQ before FLAGS */
+  while (!ascii_strncasecmp ("UID ", s, 4) ||
+         !ascii_strncasecmp ("MODSEQ ", s, 7))
+  {
+    s = imap_next_word (s);
+    s = imap_next_word (s);
+  }
+
   if (ascii_strncasecmp ("FLAGS", s, 5) != 0)
   {
     dprint (2, (debugfile, "Only handle FLAGS updates\n"));
@@ -855,37 +967,64 @@ static void cmd_parse_myrights (IMAP_DATA* idata, const char* s)
   }
 }
 
-/* This should be optimised (eg with a tree or hash) */
-static int uid2msgno (IMAP_DATA* idata, unsigned int uid)
+/* cmd_parse_search: store SEARCH response for later use */
+static void cmd_parse_search (IMAP_DATA* idata, const char* s)
 {
-  int i;
-  
-  for (i = 0; i < idata->ctx->msgcount; i++)
+  HEADER* h;
+
+  dprint (2, (debugfile, "Handling SEARCH\n"));
+
+  while ((s = imap_next_word ((char*)s)) && *s != '\0')
   {
-    HEADER* h = idata->ctx->hdrs[i];
-    if (HEADER_DATA(h)->uid == uid)
-      return i;
+    if ((h = imap_msn_uid (idata, (unsigned int) atoi (s))))
+      h->matched = 1;
   }
-  
-  return -1;
 }
 
-/* cmd_parse_search: store SEARCH response for later use */
-static void cmd_parse_search (IMAP_DATA* idata, const char* s)
+/* cmd_parse_esearch: store the ALL result of an ESEARCH response (RFC 4731)
+ *   as for SEARCH */
+static void cmd_parse_esearch (IMAP_DATA* idata, char* s)
 {
-  unsigned int uid;
-  int msgno;
+  unsigned int* ranges;
+  int nranges, i;
+  HEADER* h;
 
-  dprint (2, (debugfile, "Handling SEARCH\n"));
+  dprint (2, (debugfile, "Handling ESEARCH\n"));
 
-  while ((s = imap_next_word ((char*)s)) && *s != '\0')
+  if (!idata->ctx)
+    return;
+
+  s = imap_next_word (s);
+  /* skip the search correlator */
+  if (*s == '(' && (s = strchr (s, ')')))
+    s = imap_next_word (s);
+
+  /* return data comes in name/value pairs, except for UID */
+  while (s && *s)
   {
-    uid = atoi (s);
-    msgno = uid2msgno (idata, uid);
-    
-    if (msgno >= 0)
-      idata->ctx->hdrs[uid2msgno (idata, uid)]->matched = 1;
+    if (!ascii_strncasecmp ("UID", s, 3) && (!s[3] || ISSPACE (s[3])))
+    {
+      s = imap_next_word (s);
+      continue;
+    }
+    if (!ascii_strncasecmp ("ALL", s, 3) && ISSPACE (s[3]))
+      break;
+    s = imap_next_word (imap_next_word (s));
   }
+  if (!s || !*s)
+    return;
+
+  s = imap_next_word (s);
+  if (!(nranges = imap_seqset_parse (s, &ranges)))
+    return;
+
+  for (i = 0; i < idata->ctx->msgcount; i++)
+  {
+    h = idata->ctx->hdrs[i];
+    if (HEADER_DATA(h) && imap_seqset_member (ranges, nranges, HEADER_DATA(h)->uid))
+      h->matched = 1;
+  }
+  FREE (&ranges);
 }
 
 /* first cut: just do buffy update. Later we may wish to cache all
@@ -900,6 +1039,7 @@ static void cmd_parse_status (IMAP_DATA* idata, char* s)
   IMAP_STATUS *status;
   unsigned int olduv, oldun;
   long litlen;
+  int gotunseen = 0;
 
   mailbox = imap_next_word (s);
 
@@ -947,12 +1087,20 @@ static void cmd_parse_status (IMAP_DATA* idata, char* s)
     else if (!ascii_strncmp ("UIDVALIDITY", s, 11))
       status->uidvalidity = count;
     else if (!ascii_strncmp ("UNSEEN", s, 6))
+    {
       status->unseen = count;
+      gotunseen = 1;
+    }
 
     s = value;
     if (*s && *s != ')')
       s = imap_next_word (s);
   }
+  /* STATUS pushed by NOTIFY need not carry UNSEEN. Count whatever arrived
+   * since the last report as unseen. */
+  if (!gotunseen && oldun && olduv == status->uidvalidity
+      && status->uidnext > oldun)
+    status->unseen += status->uidnext - oldun;
   dprint (3, (debugfile, "%s (UIDVALIDITY: %d, UIDNEXT: %d) %d messages, %d recent, %d unseen\n",
               status->name, status->uidvalidity, status->uidnext,
               status->messages, status->recent, status->unseen));
@@ -1037,5 +1185,42 @@ static void cmd_parse_enabled (IMAP_DATA* idata, const char* s)
     if (ascii_strncasecmp(s, "UTF8=ACCEPT", 11) == 0 ||
         ascii_strncasecmp(s, "UTF8=ONLY", 9) == 0)
       idata->unicode = 1;
+    else if (ascii_strncasecmp (s, "QRESYNC", 7) == 0)
+      idata->qresync = 1;
   }
 }
+
+/* cmd_parse_vanished: QRESYNC replacement for EXPUNGE, reporting a set of
+ *   UIDs instead of one sequence number at a time. VANISHED (EARLIER)
+ *   answers the QRESYNC parameter of SELECT and is kept for
+ *   imap_read_headers. */
+static void cmd_parse_vanished (IMAP_DATA* idata, char* s)
+{
+  unsigned int* ranges = NULL;
+  int nranges;
+
+  dprint (2, (debugfile, "Handling VANISHED\n"));
+
+  s = imap_next_word (s);
+  if (!ascii_strncasecmp ("(EARLIER)", s, 9))
+  {
+    s = imap_next_word (s);
+    if (idata->qrdata)
+    {
+      if (!idata->qrdata->vanished)
+        idata->qrdata->vanished = mutt_buffer_new ();
+      else
+        mutt_buffer_addch (idata->qrdata->vanished, ',');
+      mutt_buffer_addstr (idata->qrdata->vanished, s);
+    }
+    return;
+  }
+
+  if (!idata->ctx || !(nranges = imap_seqset_parse (s, &ranges)))
+    return;
+
+  /* mark the vanished headers as for EXPUNGE */
+  if (imap_msn_vanished (idata, ranges, nranges))
+    idata->reopen |= IMAP_EXPUNGE_PENDING;
+  FREE (&ranges);
+}
@@ -34,6 +34,9 @@
 #if defined(USE_SSL)
 # include "mutt_ssl.h"
 #endif
+#ifdef USE_ZLIB
+# include "mutt_zstrm.h"
+#endif
 #include "buffy.h"
 #if USE_HCACHE
 #include "hcache.h"
@@ -196,21 +199,58 @@ void imap_logout_all (void)
   }
 }
 
-/* imap_read_literal: read bytes bytes from server into file. Not explicitly
- *   buffered, relies on FILE buffering. NOTE: strips \r from \r\n.
+/* literal_unfold: copy n bytes of literal from span to out, turning \r\n
+ *   into \n. *cr carries a trailing \r over to the next span. Returns the
+ *   number of bytes written, at most n + 1. */
+static size_t literal_unfold (const char* span, size_t n, char* out, int* cr)
+{
+  const char* end = span + n;
+  const char* q;
+  char* p = out;
+
+  if (*cr && n)
+  {
+    if (*span != '\n')
+      *p++ = '\r';
+    *cr = 0;
+  }
+
+  while (span < end)
+  {
+    if (!(q = memchr (span, '\r', end - span)))
+      q = end;
+    memcpy (p, span, q - span);
+    p += q - span;
+    if (q == end)
+      break;
+
+    if (q + 1 == end)
+      *cr = 1;
+    else if (q[1] != '\n')
+      *p++ = '\r';
+    span = q + 1;
+  }
+
+  return p - out;
+}
+
+/* imap_read_literal: read bytes bytes from server into file. Copies whole
+ *   spans of the connection's input buffer, FILE buffering does the rest.
+ *   NOTE: strips \r from \r\n.
  *   Apparently even literals use \r\n-terminated strings ?! */
 int imap_read_literal (FILE* fp, IMAP_DATA* idata, long bytes, progress_t* pbar)
 {
+  const char* span;
+  char buf[LONG_STRING + 1];
   long pos;
-  char c;
-
-  int r = 0;
+  int n, r = 0;
 
   dprint (2, (debugfile, "imap_read_literal: reading %ld bytes\n", bytes));
 
-  for (pos = 0; pos < bytes; pos++)
+  for (pos = 0; pos < bytes; pos += n)
   {
-    if (mutt_socket_readchar (idata->conn, &c) != 1)
+    if ((n = mutt_socket_readspan (idata->conn, &span,
+                                   MIN (bytes - pos, LONG_STRING))) < 0)
     {
       dprint (1, (debugfile, "imap_read_literal: error during read, %ld bytes read\n", pos));
       idata->status = IMAP_FATAL;
@@ -218,28 +258,61 @@ int imap_read_literal (FILE* fp, IMAP_DATA* idata, long bytes, progress_t* pbar)
       return -1;
     }
 
-#if 1
-    if (r == 1 && c != '\n')
-      fputc ('\r', fp);
+    fwrite (buf, 1, literal_unfold (span, n, buf, &r), fp);
+
+    if (pbar)
+      mutt_progress_update (pbar, pos + n, -1);
+#ifdef DEBUG
+    if (debuglevel >= IMAP_LOG_LTRL)
+      fwrite (span, 1, n, debugfile);
+#endif
+  }
 
-    if (c == '\r')
+  return 0;
+}
+
+/* imap_read_literal_buf: like imap_read_literal, but append the literal to
+ *   a BUFFER in memory instead of writing it to a file */
+int imap_read_literal_buf (BUFFER* buf, IMAP_DATA* idata, long bytes)
+{
+  const char* span;
+  long pos;
+  size_t len;
+  char* p;
+  int n, r = 0;
+
+  dprint (2, (debugfile, "imap_read_literal_buf: reading %ld bytes\n", bytes));
+
+  /* CRLF is stored as LF, so the literal never grows */
+  len = buf->dptr - buf->data;
+  if (buf->dsize < len + bytes + 1)
+  {
+    buf->dsize = len + bytes + 1;
+    safe_realloc (&buf->data, buf->dsize);
+    buf->dptr = buf->data + len;
+  }
+  p = buf->dptr;
+
+  for (pos = 0; pos < bytes; pos += n)
+  {
+    if ((n = mutt_socket_readspan (idata->conn, &span, bytes - pos)) < 0)
     {
-      r = 1;
-      continue;
+      dprint (1, (debugfile, "imap_read_literal_buf: error during read, %ld bytes read\n", pos));
+      idata->status = IMAP_FATAL;
+
+      return -1;
     }
-    else
-      r = 0;
-#endif
-    fputc (c, fp);
 
-    if (pbar && !(pos % 1024))
-      mutt_progress_update (pbar, pos, -1);
+    p += literal_unfold (span, n, p, &r);
 #ifdef DEBUG
     if (debuglevel >= IMAP_LOG_LTRL)
-      fputc (c, debugfile);
+      fwrite (span, 1, n, debugfile);
 #endif
   }
 
+  *p = '\0';
+  buf->dptr = p;
+
   return 0;
 }
 
@@ -251,6 +324,8 @@ void imap_expunge_mailbox (IMAP_DATA* idata)
   HEADER* h;
   int i, cacheno;
 
+  imap_msn_compact (idata);
+
 #ifdef USE_HCACHE
   idata->hcache = imap_hcache_open (idata, NULL);
 #endif
@@ -345,6 +420,8 @@ IMAP_DATA* imap_conn_find (const ACCOUNT* account, int flags)
     }
     if (flags & M_IMAP_CONN_NOSELECT && idata && idata->state >= IMAP_SELECTED)
       continue;
+    if (idata && idata->reserved)
+      continue;
     if (idata && idata->status == IMAP_FATAL)
       continue;
     break;
@@ -384,11 +461,24 @@ IMAP_DATA* imap_conn_find (const ACCOUNT* account, int flags)
   }
   if (new && idata->state == IMAP_AUTHENTICATED)
   {
+#ifdef USE_ZLIB
+    /* RFC 4978: must not be pipelined, everything after the OK is deflated */
+    if (option (OPTIMAPDEFLATE)
+        && mutt_bit_isset (idata->capabilities, COMPRESS_DEFLATE)
+        && imap_exec (idata, "COMPRESS DEFLATE", IMAP_CMD_FAIL_OK) == 0)
+      mutt_zstrm_wrap_conn (idata->conn);
+#endif
     /* capabilities may have changed */
     imap_exec (idata, "CAPABILITY", IMAP_CMD_QUEUE);
     /* enable RFC6855, if the server supports that */
     if (mutt_bit_isset (idata->capabilities, ENABLE))
       imap_exec (idata, "ENABLE UTF8=ACCEPT", IMAP_CMD_QUEUE);
+#if USE_HCACHE
+    /* RFC 7162: let SELECT tell us what changed since the cache was saved */
+    if (HeaderCache && mutt_bit_isset (idata->capabilities, ENABLE)
+        && mutt_bit_isset (idata->capabilities, QRESYNC))
+      imap_exec (idata, "ENABLE QRESYNC", IMAP_CMD_QUEUE);
+#endif
     /* get root delimiter, '/' as default */
     idata->delim = '/';
     imap_exec (idata, "LIST \"\" \"\"", IMAP_CMD_QUEUE);
@@ -493,6 +583,8 @@ void imap_close_connection(IMAP_DATA* idata)
     mutt_socket_close (idata->conn);
     idata->state = IMAP_DISCONNECTED;
   }
+  /* the server forgets the NOTIFY SET with the connection */
+  FREE (&idata->notifyset);
   idata->seqno = idata->nextcmd = idata->lastcmd = idata->status = 0;
   memset (idata->cmds, 0, sizeof (IMAP_COMMAND) * idata->cmdslots);
 }
@@ -554,12 +646,42 @@ static char* imap_get_flags (LIST** hflags, char* s)
   return s;
 }
 
+#if USE_HCACHE
+/* imap_select_qresync: if the header cache remembers the UIDVALIDITY and
+ *   HIGHESTMODSEQ of the mailbox, build the QRESYNC parameter for SELECT
+ *   and prepare to collect the changes the server reports in reply. */
+static void imap_select_qresync (IMAP_DATA* idata, char* buf, size_t blen)
+{
+  header_cache_t* hc;
+  unsigned int* uidvalidity;
+  unsigned long long* modseq;
+
+  *buf = '\0';
+  if (!idata->qresync || !(hc = imap_hcache_open (idata, idata->mailbox)))
+    return;
+
+  uidvalidity = mutt_hcache_fetch_raw (hc, "/UIDVALIDITY", imap_hcache_keylen);
+  modseq = mutt_hcache_fetch_raw (hc, "/MODSEQ", imap_hcache_keylen);
+  mutt_hcache_close (hc);
+
+  if (uidvalidity && modseq && *modseq)
+  {
+    snprintf (buf, blen, " (QRESYNC (%u %llu))", *uidvalidity, *modseq);
+    idata->qrdata = safe_calloc (1, sizeof (IMAP_QRESYNC));
+  }
+
+  FREE (&uidvalidity);
+  FREE (&modseq);
+}
+#endif
+
 int imap_open_mailbox (CONTEXT* ctx)
 {
   IMAP_DATA *idata;
   IMAP_STATUS* status;
   char buf[LONG_STRING];
   char bufout[LONG_STRING];
+  char qresync[SHORT_STRING];
   int count = 0;
   IMAP_MBOX mx, pmx;
   int rc;
@@ -597,6 +719,7 @@ int imap_open_mailbox (CONTEXT* ctx)
   idata->status = 0;
   memset (idata->ctx->rights, 0, sizeof (idata->ctx->rights));
   idata->newMailCount = 0;
+  imap_msn_free (idata);
 
   mutt_message (_("Selecting %s..."), idata->mailbox);
   imap_munge_mbox_name (idata, buf, sizeof(buf), idata->mailbox);
@@ -626,8 +749,15 @@ int imap_open_mailbox (CONTEXT* ctx)
     imap_status (Postponed, 1);
   FREE (&pmx.mbox);
 
-  snprintf (bufout, sizeof (bufout), "%s %s",
-    ctx->readonly ? "EXAMINE" : "SELECT", buf);
+  idata->modseq = 0;
+  imap_qresync_free (&idata->qrdata);
+  qresync[0] = '\0';
+#if USE_HCACHE
+  imap_select_qresync (idata, qresync, sizeof (qresync));
+#endif
+
+  snprintf (bufout, sizeof (bufout), "%s %s%s",
+    ctx->readonly ? "EXAMINE" : "SELECT", buf, qresync);
 
   idata->state = IMAP_SELECTED;
 
@@ -684,6 +814,18 @@ int imap_open_mailbox (CONTEXT* ctx)
       idata->uidnext = strtol (pc, NULL, 10);
       status->uidnext = idata->uidnext;
     }
+    else if (ascii_strncasecmp ("OK [HIGHESTMODSEQ", pc, 17) == 0)
+    {
+      dprint (3, (debugfile, "Getting mailbox HIGHESTMODSEQ\n"));
+      pc += 3;
+      pc = imap_next_word (pc);
+      idata->modseq = strtoull (pc, NULL, 10);
+    }
+    else if (ascii_strncasecmp ("OK [NOMODSEQ", pc, 12) == 0)
+    {
+      dprint (3, (debugfile, "Mailbox has no MODSEQ\n"));
+      idata->modseq = 0;
+    }
     else
     {
       pc = imap_next_word (pc);
@@ -763,6 +905,7 @@ int imap_open_mailbox (CONTEXT* ctx)
   return 0;
 
  fail:
+  imap_qresync_free (&idata->qrdata);
   if (idata->state == IMAP_SELECTED)
     idata->state = IMAP_AUTHENTICATED;
  fail_noidata:
@@ -1077,9 +1220,50 @@ int imap_sync_message (IMAP_DATA *idata, HEADER *hdr, BUFFER *cmd,
 
   mutt_remove_trailing_ws (flags);
 
+  /* headers restored from the cache by QRESYNC don't know their custom
+   * tags, so add and remove the system flags instead of replacing them */
+  if (HEADER_DATA(hdr)->nokeywords)
+  {
+    if (*flags)
+    {
+      mutt_buffer_addstr (cmd, " +FLAGS.SILENT (");
+      mutt_buffer_addstr (cmd, flags);
+      mutt_buffer_addstr (cmd, ")");
+
+      hdr->active = 0;
+      if ((imap_exec (idata, cmd->data, 0) != 0) &&
+          err_continue && (*err_continue != M_YES))
+      {
+        *err_continue = imap_continue ("imap_sync_message: STORE failed",
+                                       idata->buf);
+        if (*err_continue != M_YES)
+          return -1;
+      }
+      hdr->active = 1;
+    }
+
+    cmd->dptr = cmd->data;
+    mutt_buffer_addstr (cmd, "UID STORE ");
+    mutt_buffer_addstr (cmd, uid);
+
+    flags[0] = '\0';
+    imap_set_flag (idata, M_ACL_SEEN, !hdr->read, "\\Seen ",
+                   flags, sizeof (flags));
+    imap_set_flag (idata, M_ACL_WRITE, !hdr->old,
+                   "Old ", flags, sizeof (flags));
+    imap_set_flag (idata, M_ACL_WRITE, !hdr->flagged,
+                   "\\Flagged ", flags, sizeof (flags));
+    imap_set_flag (idata, M_ACL_WRITE, !hdr->replied,
+                   "\\Answered ", flags, sizeof (flags));
+    imap_set_flag (idata, M_ACL_DELETE, !hdr->deleted,
+                   "\\Deleted ", flags, sizeof (flags));
+    mutt_remove_trailing_ws (flags);
+
+    mutt_buffer_addstr (cmd, " -FLAGS.SILENT (");
+  }
   /* UW-IMAP is OK with null flags, Cyrus isn't. The only solution is to
    * explicitly revoke all system flags (if we have permission) */
-  if (!*flags)
+  else if (!*flags)
   {
     imap_set_flag (idata, M_ACL_SEEN, 1, "\\Seen ", flags, sizeof (flags));
     imap_set_flag (idata, M_ACL_WRITE, 1, "Old ", flags, sizeof (flags));
@@ -1345,6 +1529,8 @@ int imap_close_mailbox (CONTEXT* ctx)
 
   if (ctx == idata->ctx)
   {
+    imap_prefetch_free (idata);
+
     if (idata->status != IMAP_FATAL && idata->state >= IMAP_SELECTED)
     {
       /* mx_close_mailbox won't sync if there are no deleted messages
@@ -1355,6 +1541,9 @@ int imap_close_mailbox (CONTEXT* ctx)
     }
 
     idata->reopen &= IMAP_REOPEN_ALLOW;
+    idata->modseq = 0;
+    imap_qresync_free (&idata->qrdata);
+    imap_msn_free (idata);
     FREE (&(idata->mailbox));
     mutt_free_list (&idata->flags);
     idata->ctx = NULL;
@@ -1467,20 +1656,207 @@ static int imap_get_mailbox (const char* path, IMAP_DATA** hidata, char* buf, si
   return 0;
 }
 
+/* buffy_pushing: the IMAP_DATA of conn if it is an idle connection the
+ *   server pushes mailbox changes to, for imap_buffy_check */
+static IMAP_DATA* buffy_pushing (CONNECTION* conn)
+{
+  IMAP_DATA* idata = (IMAP_DATA*) conn->data;
+
+  if (conn->account.type != M_ACCT_TYPE_IMAP || !idata
+      || !(idata->notifyset || idata->watch)
+      || idata->state != IMAP_AUTHENTICATED || idata->status == IMAP_FATAL)
+    return NULL;
+
+  return idata;
+}
+
+/* buffy_drain: read whatever the servers have pushed since the last check.
+ *   NOTIFY sends STATUS, which updates the buffy list as usual. Activity
+ *   in a watched mailbox just sets watchchanged. */
+static void buffy_drain (void)
+{
+  CONNECTION* conn;
+  IMAP_DATA* idata;
+
+  for (conn = mutt_socket_head (); conn; conn = conn->next)
+  {
+    if (!(idata = buffy_pushing (conn)))
+      continue;
+
+    while (mutt_socket_poll (conn) > 0)
+      if (imap_cmd_step (idata) != IMAP_CMD_CONTINUE)
+      {
+        dprint (1, (debugfile, "buffy_drain: error reading from %s\n",
+                    conn->account.host));
+        break;
+      }
+
+    /* renew the IDLE before the server gives up on it */
+    if (idata->watch && idata->state == IMAP_AUTHENTICATED
+        && idata->status != IMAP_FATAL
+        && time (NULL) >= idata->lastread + ImapKeepalive)
+    {
+      if (imap_cmd_idle (idata) < 0)
+      {
+        FREE (&idata->watch);
+        idata->reserved = 0;
+      }
+      else
+        idata->state = IMAP_AUTHENTICATED;
+    }
+  }
+}
+
+/* buffy_watch: find the connection IDLEing in mailbox name on idata's
+ *   server, opening one if there is none yet. A new watch starts out
+ *   changed, so the mailbox gets its first STATUS. */
+static IMAP_DATA* buffy_watch (IMAP_DATA* idata, const char* name)
+{
+  CONNECTION* conn;
+  IMAP_DATA* widata;
+  char buf[LONG_STRING];
+  char mbox[LONG_STRING];
+
+  for (conn = mutt_socket_head (); conn; conn = conn->next)
+  {
+    widata = (IMAP_DATA*) conn->data;
+    if (conn->account.type != M_ACCT_TYPE_IMAP || !widata || !widata->watch
+        || !imap_account_match (&idata->conn->account, &conn->account)
+        || imap_mxcmp (widata->watch, name))
+      continue;
+
+    if (widata->state == IMAP_AUTHENTICATED && widata->status != IMAP_FATAL)
+      return widata;
+
+    /* connection lost, start over */
+    FREE (&widata->watch);
+    widata->reserved = 0;
+  }
+
+  /* don't let imap_conn_find hand back the polling connection */
+  idata->reserved = 1;
+  widata = imap_conn_find (&idata->conn->account, M_IMAP_CONN_NOSELECT |
+                           (option (OPTIMAPPASSIVE) ? M_IMAP_CONN_NONEW : 0));
+  idata->reserved = 0;
+  if (!widata || widata->state != IMAP_AUTHENTICATED)
+    return NULL;
+
+  imap_munge_mbox_name (widata, mbox, sizeof (mbox), name);
+  snprintf (buf, sizeof (buf), "EXAMINE %s", mbox);
+  if (imap_exec (widata, buf, IMAP_CMD_FAIL_OK) < 0)
+    return NULL;
+  if (imap_cmd_idle (widata) < 0)
+  {
+    imap_exec (widata, "CLOSE", IMAP_CMD_FAIL_OK);
+    return NULL;
+  }
+
+  /* there is no context for this mailbox: stay out of the SELECTED states
+   * so EXISTS and friends only mark the watch as changed */
+  widata->state = IMAP_AUTHENTICATED;
+  widata->reserved = 1;
+  widata->watch = safe_strdup (name);
+  widata->watchchanged = 1;
+  dprint (2, (debugfile, "buffy_watch: IDLEing in %s\n", mbox));
+
+  return widata;
+}
+
+/* buffy_notify: ask the server to push STATUS for the mailboxes idata
+ *   owns (RFC 5465), unless it already does. Returns 0 if it does, -1 if
+ *   they have to be polled this time: for the counts to start from, because
+ *   the server refused, or because idata has a mailbox selected. Nothing
+ *   reads such a connection between NOOPs, which may be $timeout apart,
+ *   so it is polled every $mail_check as usual. */
+static int buffy_notify (IMAP_DATA* idata, IMAP_DATA** owners, char** names,
+                         int n, int force)
+{
+  BUFFER* set;
+  BUFFER* cmd;
+  int rc = -1, i;
+
+  if (idata->state >= IMAP_SELECTED)
+    return -1;
+
+  set = mutt_buffer_new ();
+  for (i = 0; i < n; i++)
+  {
+    if (owners[i] != idata)
+      continue;
+    mutt_buffer_addstr (set, set->data ? " " : "(");
+    mutt_buffer_addstr (set, names[i]);
+  }
+  mutt_buffer_addch (set, ')');
+
+  if (!mutt_strcmp (set->data, idata->notifyset))
+    rc = force ? -1 : 0;
+  else
+  {
+    cmd = mutt_buffer_new ();
+    mutt_buffer_printf (cmd, "NOTIFY SET"
+                        " (selected (MessageNew MessageExpunge FlagChange))"
+                        " (mailboxes %s (MessageNew MessageExpunge))",
+                        set->data);
+    if (imap_exec (idata, cmd->data, IMAP_CMD_FAIL_OK) == 0)
+      mutt_str_replace (&idata->notifyset, set->data);
+    else
+    {
+      dprint (1, (debugfile, "buffy_notify: NOTIFY failed, polling instead\n"));
+      mutt_bit_unset (idata->capabilities, NOTIFY);
+      FREE (&idata->notifyset);
+    }
+    mutt_buffer_free (&cmd);
+  }
+
+  mutt_buffer_free (&set);
+
+  return rc;
+}
+
+/* imap_buffy_pending: nonzero if a server has pushed changes which
+ *   imap_buffy_check hasn't read yet */
+int imap_buffy_pending (void)
+{
+  CONNECTION* conn;
+
+  for (conn = mutt_socket_head (); conn; conn = conn->next)
+    if (buffy_pushing (conn) && mutt_socket_poll (conn) > 0)
+      return 1;
+
+  return 0;
+}
+
 /* check for new mail in any subscribed mailboxes. Given a list of mailboxes
  * rather than called once for each so that it can batch the commands and
- * save on round trips. Returns number of mailboxes with new mail. */
+ * save on round trips. The servers are polled in parallel, see
+ * imap_exec_all. Returns number of mailboxes with new mail. */
 int imap_buffy_check (int force)
 {
   IMAP_DATA* idata;
-  IMAP_DATA* lastdata = NULL;
+  IMAP_DATA* widata;
+  IMAP_DATA** owners;
+  IMAP_DATA** polled;
+  char** names;
   BUFFY* mailbox;
+  BUFFER* cmd;
   char name[LONG_STRING];
   char command[LONG_STRING];
   char munged[LONG_STRING];
   int buffies = 0;
+  int nmailboxes = 0, npolled = 0, nqueued, oldnew, i, j;
 
   for (mailbox = Incoming; mailbox; mailbox = mailbox->next)
+    nmailboxes++;
+  if (!nmailboxes)
+    return 0;
+  owners = safe_calloc (nmailboxes, sizeof (IMAP_DATA*));
+  polled = safe_calloc (nmailboxes, sizeof (IMAP_DATA*));
+  names = safe_calloc (nmailboxes, sizeof (char*));
+
+  buffy_drain ();
+
+  /* find the connection for each mailbox to be polled */
+  for (mailbox = Incoming, i = 0; mailbox; mailbox = mailbox->next, i++)
   {
     /* Init newly-added mailboxes */
     if (! mailbox->magic)
@@ -1492,6 +1868,7 @@ int imap_buffy_check (int force)
     if (mailbox->magic != M_IMAP)
       continue;
 
+    oldnew = mailbox->new;
     mailbox->new = 0;
 
     if (imap_get_mailbox (mailbox->path, &idata, name, sizeof (name)) < 0)
@@ -1511,35 +1888,99 @@ int imap_buffy_check (int force)
       continue;
     }
 
-    if (lastdata && idata != lastdata)
+    /* pushed changes have already been read. Poll a watched mailbox only
+     * if its IDLE has seen some activity. */
+    if (mutt_bit_isset (idata->capabilities, NOTIFY))
     {
-      /* Send commands to previous server. Sorting the buffy list
-       * may prevent some infelicitous interleavings */
-      if (imap_exec (lastdata, NULL, IMAP_CMD_FAIL_OK) == -1)
-        dprint (1, (debugfile, "Error polling mailboxes\n"));
+      if (!force)
+        mailbox->new = oldnew;
+    }
+    else if (ImapIdleMailboxes.rx && mutt_bit_isset (idata->capabilities, IDLE)
+             && !regexec (ImapIdleMailboxes.rx, mailbox->path, 0, NULL, 0)
+             && (widata = buffy_watch (idata, name)))
+    {
+      if (!force && !widata->watchchanged)
+      {
+        mailbox->new = oldnew;
+        continue;
+      }
+      widata->watchchanged = 0;
+    }
+
+    imap_munge_mbox_name (idata, munged, sizeof (munged), name);
+    names[i] = safe_strdup (munged);
+    owners[i] = idata;
+    for (j = 0; j < npolled && polled[j] != idata; j++)
+      ;
+    if (j == npolled)
+      polled[npolled++] = idata;
+  }
 
-      lastdata = NULL;
+  /* queue the commands for each server. LIST-STATUS asks about all of a
+   * server's mailboxes in a single command, and a server with NOTIFY needs
+   * no command at all once it pushes the changes. */
+  for (j = 0; j < npolled; j++)
+  {
+    idata = polled[j];
+    nqueued = 0;
+
+    if (mutt_bit_isset (idata->capabilities, NOTIFY)
+        && buffy_notify (idata, owners, names, nmailboxes, force) == 0)
+    {
+      polled[j] = NULL;
+      continue;
     }
 
-    if (!lastdata)
-      lastdata = idata;
+    cmd = mutt_buffer_new ();
+    for (i = 0; i < nmailboxes; i++)
+    {
+      if (owners[i] != idata)
+        continue;
 
-    imap_munge_mbox_name (idata, munged, sizeof (munged), name);
-    snprintf (command, sizeof (command),
-	      "STATUS %s (UIDNEXT UIDVALIDITY UNSEEN RECENT)", munged);
+      if (mutt_bit_isset (idata->capabilities, LIST_EXTENDED) &&
+          mutt_bit_isset (idata->capabilities, LIST_STATUS))
+      {
+        mutt_buffer_addstr (cmd, nqueued ? " " : "LIST \"\" (");
+        mutt_buffer_addstr (cmd, names[i]);
+        nqueued++;
+        continue;
+      }
 
-    if (imap_exec (idata, command, IMAP_CMD_QUEUE) < 0)
+      snprintf (command, sizeof (command),
+                "STATUS %s (UIDNEXT UIDVALIDITY UNSEEN RECENT)", names[i]);
+
+      if (imap_exec (idata, command, IMAP_CMD_QUEUE) < 0)
+      {
+        dprint (1, (debugfile, "Error queueing command\n"));
+        break;
+      }
+      nqueued++;
+    }
+
+    if (cmd->data && *cmd->data)
     {
-      dprint (1, (debugfile, "Error queueing command\n"));
-      return 0;
+      mutt_buffer_addstr (cmd, ") RETURN (STATUS (UIDNEXT UIDVALIDITY UNSEEN RECENT))");
+      if (imap_exec (idata, cmd->data, IMAP_CMD_QUEUE) < 0)
+        nqueued = 0;
     }
+
+    mutt_buffer_free (&cmd);
+
+    if (!nqueued)
+      polled[j] = NULL;
   }
 
-  if (lastdata && (imap_exec (lastdata, NULL, IMAP_CMD_FAIL_OK) == -1))
-  {
+  for (i = j = 0; j < npolled; j++)
+    if (polled[j])
+      polled[i++] = polled[j];
+  if (i && imap_exec_all (polled, i, ImapPollTimeout) < i)
     dprint (1, (debugfile, "Error polling mailboxes\n"));
-    return 0;
-  }
+
+  for (i = 0; i < nmailboxes; i++)
+    FREE (&names[i]);
+  FREE (&names);
+  FREE (&polled);
+  FREE (&owners);
 
   /* collect results */
   for (mailbox = Incoming; mailbox; mailbox = mailbox->next)
@@ -1701,12 +2142,79 @@ static int do_search (const pattern_t* search, int allpats)
   return rc;
 }
 
+/* search_exact: can the server evaluate pat (and its siblings, if allpats)
+ *   on its own? Simple string matches on the envelope are only sent along
+ *   with the full-text terms that need the server anyway, and only if they
+ *   ignore case like the server does. */
+static int search_exact (const pattern_t* pat, int allpats)
+{
+  for (; pat; pat = pat->next)
+  {
+    switch (pat->op)
+    {
+      case M_BODY:
+      case M_HEADER:
+      case M_WHOLE_MSG:
+        if (!pat->stringmatch)
+          return 0;
+        break;
+      case M_FROM:
+      case M_TO:
+      case M_CC:
+      case M_SUBJECT:
+        /* SEARCH never minds case, but locally =s Foo does. Nor can it
+         * insist on every address matching, like ^=t foo */
+        if (!pat->stringmatch || !pat->ign_case || pat->alladdr)
+          return 0;
+        break;
+      case M_AND:
+      case M_OR:
+        if (!search_exact (pat->child, 1))
+          return 0;
+        break;
+      default:
+        return 0;
+    }
+
+    if (!allpats)
+      break;
+  }
+
+  return 1;
+}
+
+/* search_count: the number of patterns in a list imap_compile_search will
+ *   send. With exact set the list is known to be translatable and all of it
+ *   is sent, otherwise only the full-text terms. */
+static int search_count (const pattern_t* pat, int exact)
+{
+  int rc = 0;
+
+  if (!exact)
+    return do_search (pat, 1);
+
+  for (; pat; pat = pat->next)
+    rc++;
+
+  return rc;
+}
+
+static void search_unmark (pattern_t* pat)
+{
+  for (; pat; pat = pat->next)
+  {
+    pat->imapmatch = 0;
+    search_unmark (pat->child);
+  }
+}
+
 /* convert mutt pattern_t to IMAP SEARCH command containing only elements
  * that require full-text search (mutt already has what it needs for most
- * match types, and does a better job (eg server doesn't support regexps). */
-static int imap_compile_search (const pattern_t* pat, BUFFER* buf)
+ * match types, and does a better job (eg server doesn't support regexps).
+ * If exact is set the whole pattern is converted (see search_exact). */
+static int imap_compile_search (const pattern_t* pat, BUFFER* buf, int exact)
 {
-  if (! do_search (pat, 0))
+  if (!exact && !do_search (pat, 0))
     return 0;
 
   if (pat->not)
@@ -1716,7 +2224,7 @@ static int imap_compile_search (const pattern_t* pat, BUFFER* buf)
   {
     int clauses;
 
-    if ((clauses = do_search (pat->child, 1)) > 0)
+    if ((clauses = search_count (pat->child, exact)) > 0)
     {
       const pattern_t* clause = pat->child;
 
@@ -1724,13 +2232,13 @@ static int imap_compile_search (const pattern_t* pat, BUFFER* buf)
 
       while (clauses)
       {
-        if (do_search (clause, 0))
+        if (exact || do_search (clause, 0))
         {
           if (pat->op == M_OR && clauses > 1)
             mutt_buffer_addstr (buf, "OR ");
           clauses--;
 
-          if (imap_compile_search (clause, buf) < 0)
+          if (imap_compile_search (clause, buf, exact) < 0)
             return -1;
 
           if (clauses)
@@ -1781,41 +2289,288 @@ static int imap_compile_search (const pattern_t* pat, BUFFER* buf)
         imap_quote_string (term, sizeof (term), pat->p.str);
         mutt_buffer_addstr (buf, term);
         break;
+      case M_FROM:
+        mutt_buffer_addstr (buf, "FROM ");
+        imap_quote_string (term, sizeof (term), pat->p.str);
+        mutt_buffer_addstr (buf, term);
+        break;
+      case M_TO:
+        mutt_buffer_addstr (buf, "TO ");
+        imap_quote_string (term, sizeof (term), pat->p.str);
+        mutt_buffer_addstr (buf, term);
+        break;
+      case M_CC:
+        mutt_buffer_addstr (buf, "CC ");
+        imap_quote_string (term, sizeof (term), pat->p.str);
+        mutt_buffer_addstr (buf, term);
+        break;
+      case M_SUBJECT:
+        mutt_buffer_addstr (buf, "SUBJECT ");
+        imap_quote_string (term, sizeof (term), pat->p.str);
+        mutt_buffer_addstr (buf, term);
+        break;
     }
   }
 
   return 0;
 }
 
-int imap_search (CONTEXT* ctx, const pattern_t* pat)
+static void search_date (BUFFER* buf, const char* key, time_t t)
+{
+  char date[SHORT_STRING];
+  struct tm* tm = gmtime (&t);
+
+  snprintf (date, sizeof (date), " %s %d-%s-%d", key, tm->tm_mday,
+            Months[tm->tm_mon], tm->tm_year + 1900);
+  mutt_buffer_addstr (buf, date);
+}
+
+/* search_hint: add a criterion matching at least the messages pat matches,
+ *   to spare the server full-text searches of messages mutt will reject
+ *   anyway. The server compares dates without times or time zones and sizes
+ *   of whole messages, so the ranges are widened to be safe. */
+static void search_hint (BUFFER* buf, const pattern_t* pat)
+{
+  char term[SHORT_STRING];
+  time_t slack = 2 * 24 * 60 * 60;
+
+  if (pat->not)
+    return;
+
+  switch (pat->op)
+  {
+    case M_DATE:
+    case M_DATE_RECEIVED:
+      if (pat->min > slack)
+        search_date (buf, pat->op == M_DATE ? "SENTSINCE" : "SINCE",
+                     pat->min - slack);
+      if (pat->max < time (NULL))
+        search_date (buf, pat->op == M_DATE ? "SENTBEFORE" : "BEFORE",
+                     pat->max + slack);
+      break;
+    case M_SIZE:
+      if (pat->min > 0)
+      {
+        snprintf (term, sizeof (term), " LARGER %d", pat->min - 1);
+        mutt_buffer_addstr (buf, term);
+      }
+      break;
+  }
+}
+
+/* imap_search: run the parts of pat mutt can't evaluate itself on the
+ *   server, leaving the result in h->matched. When every top level term that
+ *   needs the server can be sent whole, those terms are marked so
+ *   mutt_pattern_exec takes the server's answer for them, and date and size
+ *   terms are sent along to narrow the search. Otherwise the full-text terms
+ *   are sent on their own and mutt_pattern_exec uses the result for each of
+ *   them. */
+int imap_search (CONTEXT* ctx, pattern_t* pat)
 {
   BUFFER buf;
   IMAP_DATA* idata = (IMAP_DATA*)ctx->data;
+  pattern_t* terms;
+  pattern_t* term;
+  int exact = 1;
   int i;
 
   for (i = 0; i < ctx->msgcount; i++)
     ctx->hdrs[i]->matched = 0;
+  search_unmark (pat);
 
   if (!do_search (pat, 1))
     return 0;
 
+  /* top level terms are ANDed together */
+  terms = (pat->op == M_AND && !pat->not) ? pat->child : pat;
+  for (term = terms; term; term = term->next)
+  {
+    if (do_search (term, 0) && !search_exact (term, 0))
+      exact = 0;
+    if (terms == pat)
+      break;
+  }
+
   mutt_buffer_init (&buf);
   mutt_buffer_addstr (&buf, "UID SEARCH ");
-  if (imap_compile_search (pat, &buf) < 0)
+  if (mutt_bit_isset (idata->capabilities, ESEARCH))
+    mutt_buffer_addstr (&buf, "RETURN (ALL) ");
+
+  if (!exact)
   {
-    FREE (&buf.data);
-    return -1;
+    if (imap_compile_search (pat, &buf, 0) < 0)
+    {
+      FREE (&buf.data);
+      return -1;
+    }
   }
+  else
+  {
+    for (term = terms, i = 0; term; term = term->next)
+    {
+      if (search_exact (term, 0))
+      {
+        if (i++)
+          mutt_buffer_addch (&buf, ' ');
+        if (imap_compile_search (term, &buf, 1) < 0)
+        {
+          FREE (&buf.data);
+          return -1;
+        }
+      }
+      if (terms == pat)
+        break;
+    }
+    for (term = terms; term; term = term->next)
+    {
+      if (!search_exact (term, 0))
+        search_hint (&buf, term);
+      if (terms == pat)
+        break;
+    }
+  }
+
   if (imap_exec (idata, buf.data, 0) < 0)
   {
     FREE (&buf.data);
     return -1;
   }
-
   FREE (&buf.data);
+
+  if (exact)
+  {
+    for (term = terms; term; term = term->next)
+    {
+      if (search_exact (term, 0))
+        term->imapmatch = 1;
+      if (terms == pat)
+        break;
+    }
+  }
+
   return 0;
 }
 
+/* imap_sort_key: the RFC 5256 sort key for a $sort method, or NULL if the
+ *   server can't sort that way */
+static const char* imap_sort_key (IMAP_DATA* idata, int method)
+{
+  switch (method & SORT_MASK)
+  {
+    case SORT_DATE:
+      return "DATE";
+    case SORT_RECEIVED:
+      return "ARRIVAL";
+    case SORT_SIZE:
+      return "SIZE";
+    case SORT_SUBJECT:
+      return "SUBJECT";
+    /* plain FROM and TO compare addresses, mutt compares names (RFC 5957) */
+    case SORT_FROM:
+      return mutt_bit_isset (idata->capabilities, SORT_DISPLAY) ?
+        "DISPLAYFROM" : NULL;
+    case SORT_TO:
+      return mutt_bit_isset (idata->capabilities, SORT_DISPLAY) ?
+        "DISPLAYTO" : NULL;
+  }
+
+  return NULL;
+}
+
+/* imap_sort: put ctx->hdrs in $sort order using the server's SORT command.
+ *   Ties are broken by $sort_aux and then by message number, as in
+ *   mutt_sort_headers. Returns 0 on success, -1 if the caller must sort the
+ *   headers itself. */
+int imap_sort (CONTEXT* ctx)
+{
+  IMAP_DATA* idata = (IMAP_DATA*) ctx->data;
+  char buf[SHORT_STRING];
+  const char* key;
+  const char* aux = NULL;
+  HEADER** bymsn;
+  HEADER** hdrs;
+  char* s;
+  unsigned char reopen;
+  int msn, n, i;
+  int rc;
+
+  if (!option (OPTIMAPSERVERSORT) || !idata || idata->ctx != ctx
+      || idata->state < IMAP_SELECTED
+      || !mutt_bit_isset (idata->capabilities, SORT)
+      || (idata->reopen & IMAP_EXPUNGE_PENDING)
+      || !(key = imap_sort_key (idata, Sort)))
+    return -1;
+  if ((SortAux & SORT_MASK) != SORT_ORDER
+      && !(aux = imap_sort_key (idata, SortAux)))
+    return -1;
+
+  /* the server answers with message sequence numbers */
+  bymsn = safe_calloc (ctx->msgcount, sizeof (HEADER*));
+  for (i = 0; i < ctx->msgcount; i++)
+  {
+    if (ctx->hdrs[i]->index < 0 || ctx->hdrs[i]->index >= ctx->msgcount
+        || bymsn[ctx->hdrs[i]->index])
+    {
+      FREE (&bymsn);
+      return -1;
+    }
+    bymsn[ctx->hdrs[i]->index] = ctx->hdrs[i];
+  }
+
+  /* mutt_sort_headers only reverses the primary key */
+  snprintf (buf, sizeof (buf), "SORT (%s%s%s%s) UTF-8 ALL",
+            (Sort & SORT_REVERSE) ? "REVERSE " : "", key,
+            aux ? " " : "", NONULL (aux));
+
+  /* new headers must not be fetched while we hold on to the old list */
+  reopen = idata->reopen & IMAP_REOPEN_ALLOW;
+  idata->reopen &= ~IMAP_REOPEN_ALLOW;
+
+  hdrs = safe_calloc (ctx->msgcount, sizeof (HEADER*));
+  n = 0;
+  imap_cmd_start (idata, buf);
+  do
+  {
+    if ((rc = imap_cmd_step (idata)) != IMAP_CMD_CONTINUE)
+      break;
+
+    s = imap_next_word (idata->buf);
+    if (ascii_strncasecmp ("SORT", s, 4))
+      continue;
+
+    for (s = imap_next_word (s); *s && n >= 0; s = imap_next_word (s))
+    {
+      msn = atoi (s);
+      if (msn < 1 || msn > ctx->msgcount || !bymsn[msn - 1])
+        n = -1;
+      else
+      {
+        hdrs[n++] = bymsn[msn - 1];
+        bymsn[msn - 1] = NULL;
+      }
+    }
+  }
+  while (rc == IMAP_CMD_CONTINUE);
+
+  idata->reopen |= reopen;
+
+  /* an EXPUNGE during the command renumbers everything */
+  if (rc == IMAP_CMD_OK && n == ctx->msgcount
+      && !(idata->reopen & IMAP_EXPUNGE_PENDING))
+    memcpy (ctx->hdrs, hdrs, n * sizeof (HEADER*));
+  else
+  {
+    dprint (1, (debugfile, "imap_sort: unusable SORT result, sorting locally\n"));
+    rc = -1;
+  }
+
+  FREE (&hdrs);
+  FREE (&bymsn);
+
+  return rc == IMAP_CMD_OK ? 0 : -1;
+}
+
+
 int imap_subscribe (char *path, int subscribe)
 {
   IMAP_DATA *idata;
@@ -40,8 +40,10 @@ int imap_open_mailbox_append (CONTEXT *ctx);
 int imap_sync_mailbox (CONTEXT *ctx, int expunge, int *index_hint);
 int imap_close_mailbox (CONTEXT *ctx);
 int imap_buffy_check (int force);
+int imap_buffy_pending (void);
 int imap_status (char *path, int queue);
-int imap_search (CONTEXT* ctx, const pattern_t* pat);
+int imap_search (CONTEXT* ctx, pattern_t* pat);
+int imap_sort (CONTEXT* ctx);
 int imap_subscribe (char *path, int subscribe);
 int imap_complete (char* dest, size_t dlen, char* path);
 
@@ -56,8 +58,12 @@ int imap_mailbox_rename (const char* mailbox);
 
 /* message.c */
 int imap_append_message (CONTEXT* ctx, MESSAGE* msg);
+int imap_append_begin (CONTEXT* ctx);
+int imap_append_commit (CONTEXT* ctx);
 int imap_copy_messages (CONTEXT* ctx, HEADER* h, char* dest, int delete);
 int imap_fetch_message (MESSAGE* msg, CONTEXT* ctx, int msgno);
+int imap_prefetch (void);
+int imap_prefetch_wait (int timeout);
 
 /* socket.c */
 void imap_logout_all (void);
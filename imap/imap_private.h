@@ -116,6 +116,18 @@ enum
   IDLE,                         /* RFC 2177: IDLE */
   SASL_IR,                      /* SASL initial response draft */
   ENABLE,                       /* RFC 5161 */
+  CONDSTORE,                    /* RFC 7162: CONDSTORE */
+  QRESYNC,                      /* RFC 7162: QRESYNC */
+  COMPRESS_DEFLATE,             /* RFC 4978: COMPRESS=DEFLATE */
+  MULTIAPPEND,                  /* RFC 3502 */
+  LITERALPLUS,                  /* RFC 7888: LITERAL+ */
+  LITERALMINUS,                 /* RFC 7888: LITERAL- */
+  SORT,                         /* RFC 5256 */
+  SORT_DISPLAY,                 /* RFC 5957: SORT=DISPLAY */
+  ESEARCH,                      /* RFC 4731: ESEARCH */
+  LIST_EXTENDED,                /* RFC 5258: LIST-EXTENDED */
+  LIST_STATUS,                  /* RFC 5819: LIST-STATUS */
+  NOTIFY,                       /* RFC 5465: NOTIFY */
 
   CAPMAX
 };
@@ -152,6 +164,38 @@ typedef struct
   unsigned char noinferiors;
 } IMAP_LIST;
 
+/* flag changes and expunges reported by the server while a mailbox is
+ * being SELECTed with QRESYNC, applied to the header cache afterwards */
+typedef struct
+{
+  IMAP_HEADER* fetch;
+  int fetchlen;
+  int fetchmax;
+  BUFFER* vanished;
+} IMAP_QRESYNC;
+
+/* a message waiting to be uploaded by MULTIAPPEND */
+typedef struct
+{
+  char* path;
+  size_t len;
+  char flags[SHORT_STRING];
+  char date[IMAP_DATELEN];
+} IMAP_APPEND;
+
+/* state of the message body prefetcher for the selected mailbox */
+typedef struct
+{
+  /* second connection to the server, NULL while idle */
+  struct imap_data* idata;
+  /* next entry of ctx->hdrs to look at, and ctx->msgcount when we started */
+  int cursor;
+  int msgcount;
+  /* bodies requested but not yet received */
+  int inflight;
+  unsigned char failed;
+} IMAP_PREFETCH;
+
 /* IMAP command structure */
 typedef struct
 {
@@ -166,7 +210,7 @@ typedef enum
   IMAP_CT_STATUS
 } IMAP_COMMAND_TYPE;
 
-typedef struct
+typedef struct imap_data
 {
   /* This data is specific to a CONNECTION to an IMAP server */
   CONNECTION *conn;
@@ -191,6 +235,20 @@ typedef struct
    * than mUTF7 */
   int unicode;
 
+  /* If nonzero, QRESYNC has been ENABLEd for this connection */
+  unsigned char qresync;
+
+  /* If nonzero, the connection is being used by the body prefetcher and
+   * must not be handed out by imap_conn_find */
+  unsigned char reserved;
+
+  /* mailboxes named in the last NOTIFY SET, see imap_buffy_check */
+  char* notifyset;
+  /* mailbox this connection IDLEs in for imap_buffy_check, and whether the
+   * server has reported any activity there since it was last polled */
+  char* watch;
+  unsigned char watchchanged;
+
   /* if set, the response parser will store results for complicated commands
    * here. */
   IMAP_COMMAND_TYPE cmdtype;
@@ -203,6 +261,12 @@ typedef struct
   int lastcmd;
   BUFFER* cmdbuf;
 
+  /* messages collected for MULTIAPPEND, see imap_append_begin */
+  CONTEXT* appendctx;
+  IMAP_APPEND* appendq;
+  int appendlen;
+  int appendmax;
+
   /* cache IMAP_STATUS of visited mailboxes */
   LIST* mboxcache;
 
@@ -217,6 +281,17 @@ typedef struct
   unsigned int uid_validity;
   unsigned int uidnext;
   body_cache_t *bcache;
+  /* HIGHESTMODSEQ of the selected mailbox, 0 if unknown */
+  unsigned long long modseq;
+  /* collects SELECT (QRESYNC ...) responses, NULL otherwise */
+  IMAP_QRESYNC* qrdata;
+  IMAP_PREFETCH* prefetch;
+  /* headers in sequence number order, see imap_msn_set */
+  HEADER** msn_index;
+  int* msn_tree;
+  int msn_max;
+  int msn_count;
+  int msn_gone;
 
   /* all folder flags - system flags AND keywords */
   LIST *flags;
@@ -242,6 +317,7 @@ int imap_open_connection (IMAP_DATA* idata);
 void imap_close_connection (IMAP_DATA* idata);
 IMAP_DATA* imap_conn_find (const ACCOUNT* account, int flags);
 int imap_read_literal (FILE* fp, IMAP_DATA* idata, long bytes, progress_t*);
+int imap_read_literal_buf (BUFFER* buf, IMAP_DATA* idata, long bytes);
 void imap_expunge_mailbox (IMAP_DATA* idata);
 void imap_logout (IMAP_DATA** idata);
 int imap_sync_message (IMAP_DATA *idata, HEADER *hdr, BUFFER *cmd,
@@ -258,6 +334,7 @@ void imap_cmd_finish (IMAP_DATA* idata);
 int imap_code (const char* s);
 const char* imap_cmd_trailer (IMAP_DATA* idata);
 int imap_exec (IMAP_DATA* idata, const char* cmd, int flags);
+int imap_exec_all (IMAP_DATA** idatas, int n, int timeout);
 int imap_cmd_idle (IMAP_DATA* idata);
 
 /* message.c */
@@ -267,6 +344,9 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend);
 char* imap_set_flags (IMAP_DATA* idata, HEADER* h, char* s);
 int imap_cache_del (IMAP_DATA* idata, HEADER* h);
 int imap_cache_clean (IMAP_DATA* idata);
+int imap_qresync_fetch (IMAP_DATA* idata, char* s);
+void imap_qresync_free (IMAP_QRESYNC** qrdata);
+void imap_prefetch_free (IMAP_DATA* idata);
 
 /* util.c */
 #ifdef USE_HCACHE
@@ -297,6 +377,16 @@ void imap_unquote_string (char* s);
 void imap_munge_mbox_name (IMAP_DATA *idata, char *dest, size_t dlen, const char *src);
 void imap_unmunge_mbox_name (IMAP_DATA *idata, char *s);
 int imap_wordcasecmp(const char *a, const char *b);
+int imap_seqset_parse (const char* s, unsigned int** ranges);
+int imap_seqset_member (const unsigned int* ranges, int n, unsigned int uid);
+void imap_seqset_make (BUFFER* buf, unsigned int* uids, int n);
+void imap_msn_set (IMAP_DATA* idata, int msn, HEADER* h);
+HEADER* imap_msn_get (IMAP_DATA* idata, int msn);
+HEADER* imap_msn_uid (IMAP_DATA* idata, unsigned int uid);
+void imap_msn_expunge (IMAP_DATA* idata, int msn);
+int imap_msn_vanished (IMAP_DATA* idata, const unsigned int* ranges, int n);
+void imap_msn_compact (IMAP_DATA* idata);
+void imap_msn_free (IMAP_DATA* idata);
 
 /* utf7.c */
 void imap_utf_encode (IMAP_DATA *idata, char **s);
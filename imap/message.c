@@ -42,16 +42,182 @@
 
 #include "bcache.h"
 
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
 static FILE* msg_cache_get (IMAP_DATA* idata, HEADER* h);
 static FILE* msg_cache_put (IMAP_DATA* idata, HEADER* h);
 static int msg_cache_commit (IMAP_DATA* idata, HEADER* h);
 
 static void flush_buffer(char* buf, size_t* len, CONNECTION* conn);
 static int msg_fetch_header (CONTEXT* ctx, IMAP_HEADER* h, char* buf,
-  FILE* fp);
+  BUFFER* hdrs);
+static int msg_parse_header (HEADER* h, BUFFER* hdrs, FILE* fp);
 static int msg_parse_fetch (IMAP_HEADER* h, char* s);
 static char* msg_parse_flags (IMAP_HEADER* h, char* s);
 
+#if USE_HCACHE
+static int qresync_fetch_cmp (const void* a, const void* b)
+{
+  unsigned int ua = ((const IMAP_HEADER*) a)->data->uid;
+  unsigned int ub = ((const IMAP_HEADER*) b)->data->uid;
+
+  return ua < ub ? -1 : ua > ub;
+}
+
+/* read_headers_qresync: restore the headers of a mailbox SELECTed with
+ *   QRESYNC from the header cache: the UIDs known last time minus those
+ *   reported VANISHED, with the FETCHed flag changes applied (and written
+ *   back to the cache). Returns 0 on success, or -1 if the cache doesn't
+ *   agree with the server, leaving the context empty. */
+static int read_headers_qresync (IMAP_DATA* idata, int msgend)
+{
+  CONTEXT* ctx = idata->ctx;
+  IMAP_QRESYNC* qrdata = idata->qrdata;
+  IMAP_HEADER* fetch;
+  IMAP_HEADER_DATA* hd;
+  HEADER* h;
+  char* uidset;
+  unsigned int* known = NULL;
+  unsigned int* gone = NULL;
+  unsigned int uid;
+  int nknown, ngone = 0, i, f = 0, idx = 0, rc = -1;
+  progress_t progress;
+
+  if (!(uidset = mutt_hcache_fetch_raw (idata->hcache, "/UIDSEQSET",
+                                        imap_hcache_keylen)))
+    return -1;
+  nknown = imap_seqset_parse (uidset, &known);
+  FREE (&uidset);
+  if (qrdata->vanished)
+    ngone = imap_seqset_parse (qrdata->vanished->data, &gone);
+
+  /* walk the FETCH responses alongside the (ascending) known UIDs */
+  if (qrdata->fetchlen > 1)
+    qsort (qrdata->fetch, qrdata->fetchlen, sizeof (IMAP_HEADER),
+           qresync_fetch_cmp);
+
+  mutt_progress_init (&progress, _("Evaluating cache..."),
+                      M_PROGRESS_MSG, ReadInc, msgend + 1);
+
+  for (i = 0; i < nknown; i++)
+  {
+    uid = known[2 * i];
+    do
+    {
+      if (ngone && imap_seqset_member (gone, ngone, uid))
+        continue;
+
+      if (idx > msgend)
+      {
+        dprint (2, (debugfile, "read_headers_qresync: more cached messages "
+                    "than the server has\n"));
+        goto bail;
+      }
+      if (!(h = imap_hcache_get (idata, uid)))
+      {
+        dprint (3, (debugfile, "read_headers_qresync: no cache entry for "
+                    "UID %u\n", uid));
+        goto bail;
+      }
+
+      while (f < qrdata->fetchlen && qrdata->fetch[f].data->uid < uid)
+        f++;
+      fetch = NULL;
+      if (f < qrdata->fetchlen && qrdata->fetch[f].data->uid == uid)
+      {
+        fetch = &qrdata->fetch[f++];
+        if (fetch->sid != idx + 1)
+        {
+          dprint (2, (debugfile, "read_headers_qresync: UID %u is message "
+                      "%d, expected %d\n", uid, fetch->sid, idx + 1));
+          mutt_free_header (&h);
+          goto bail;
+        }
+        hd = fetch->data;
+        fetch->data = NULL;
+      }
+      else
+      {
+        hd = safe_calloc (1, sizeof (IMAP_HEADER_DATA));
+        hd->uid = uid;
+        hd->read = h->read;
+        hd->old = h->old;
+        hd->deleted = h->deleted;
+        hd->flagged = h->flagged;
+        hd->replied = h->replied;
+        hd->nokeywords = 1;
+      }
+
+      mutt_progress_update (&progress, idx + 1, -1);
+
+      h->index = idx;
+      h->active = 1;
+      h->read = hd->read;
+      h->old = hd->old;
+      h->deleted = hd->deleted;
+      h->flagged = hd->flagged;
+      h->replied = hd->replied;
+      h->changed = hd->changed;
+      h->data = (void *) hd;
+      if (fetch)
+        imap_hcache_put (idata, h);
+
+      ctx->hdrs[idx++] = h;
+      ctx->msgcount++;
+      ctx->size += h->content->length;
+    }
+    while (uid++ != known[2 * i + 1]);
+  }
+
+  dprint (2, (debugfile, "read_headers_qresync: restored %d messages, %d "
+              "changed\n", ctx->msgcount, qrdata->fetchlen));
+  rc = 0;
+
+bail:
+  if (rc)
+  {
+    for (i = 0; i < ctx->msgcount; i++)
+    {
+      imap_free_header_data ((IMAP_HEADER_DATA**) &ctx->hdrs[i]->data);
+      mutt_free_header (&ctx->hdrs[i]);
+    }
+    ctx->msgcount = 0;
+    ctx->size = 0;
+  }
+  FREE (&known);
+  FREE (&gone);
+
+  return rc;
+}
+
+/* write the UIDs and HIGHESTMODSEQ the header cache now reflects, for the
+ * next SELECT (QRESYNC ...) */
+static void save_qresync_state (IMAP_DATA* idata)
+{
+  CONTEXT* ctx = idata->ctx;
+  BUFFER* uidset;
+  unsigned int* uids;
+  int i, n = 0;
+
+  uids = safe_malloc (ctx->msgcount * sizeof (unsigned int) + 1);
+  for (i = 0; i < ctx->msgcount; i++)
+    if (ctx->hdrs[i]->index >= 0 && HEADER_DATA(ctx->hdrs[i]))
+      uids[n++] = HEADER_DATA(ctx->hdrs[i])->uid;
+
+  uidset = mutt_buffer_new ();
+  imap_seqset_make (uidset, uids, n);
+  FREE (&uids);
+
+  mutt_hcache_store_raw (idata->hcache, "/UIDSEQSET", NONULL (uidset->data),
+                         mutt_strlen (uidset->data) + 1, imap_hcache_keylen);
+  mutt_hcache_store_raw (idata->hcache, "/MODSEQ", &idata->modseq,
+                         sizeof (idata->modseq), imap_hcache_keylen);
+  mutt_buffer_free (&uidset);
+}
+#endif
+
 /* imap_read_headers:
  * Changed to read many headers instead of just one. It will return the
  * msgno of the last message read. It will return a value other than
@@ -61,13 +227,16 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
 {
   CONTEXT* ctx;
   char *hdrreq = NULL;
-  FILE *fp;
+  BUFFER *hdrs;
+  FILE *fp = NULL;
+#ifndef HAVE_FMEMOPEN
   char tempfile[_POSIX_PATH_MAX];
+#endif
   int msgno, idx = msgbegin - 1;
   IMAP_HEADER h;
   IMAP_STATUS* status;
   int rc, mfhrc, oldmsgcount;
-  int fetchlast = 0;
+  int fetchlast = 0, fetchnext;
   int maxuid = 0;
   static const char * const want_headers = "DATE FROM SUBJECT TO CC MESSAGE-ID REFERENCES CONTENT-TYPE CONTENT-DESCRIPTION IN-REPLY-TO REPLY-TO LINES LIST-POST X-LABEL";
   progress_t progress;
@@ -79,6 +248,7 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
   unsigned int *puidnext = NULL;
   unsigned int uidnext = 0;
   int evalhc = 0;
+  int stale;
 #endif /* USE_HCACHE */
 
   ctx = idata->ctx;
@@ -101,20 +271,26 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
   }
 
   /* instead of downloading all headers and then parsing them, we parse them
-   * as they come in. */
+   * from memory as they come in. */
+  hdrs = mutt_buffer_new ();
+#ifndef HAVE_FMEMOPEN
   mutt_mktemp (tempfile, sizeof (tempfile));
   if (!(fp = safe_fopen (tempfile, "w+")))
   {
     mutt_error (_("Could not create temporary file %s"), tempfile);
     mutt_sleep (2);
-    goto error_out_0;
+    goto error_out_1;
   }
   unlink (tempfile);
+#endif
 
   /* make sure context has room to hold the mailbox */
   while ((msgend) >= idata->ctx->hdrmax)
     mx_alloc_memory (idata->ctx);
 
+  /* new messages are numbered after any EXPUNGEs */
+  imap_msn_compact (idata);
+
   oldmsgcount = ctx->msgcount;
   idata->reopen &= ~(IMAP_REOPEN_ALLOW|IMAP_NEWMAIL_PENDING);
   idata->newMailCount = 0;
@@ -135,6 +311,14 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
       evalhc = 1;
     FREE (&uid_validity);
   }
+  if (evalhc && idata->qrdata && idata->modseq
+      && !read_headers_qresync (idata, msgend))
+  {
+    evalhc = 0;
+    idx = ctx->msgcount - 1;
+    msgbegin = ctx->msgcount;
+  }
+  imap_qresync_free (&idata->qrdata);
   if (evalhc)
   {
     /* L10N:
@@ -189,6 +373,14 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
         ctx->hdrs[idx] = imap_hcache_get (idata, h.data->uid);
         if (ctx->hdrs[idx])
         {
+          /* QRESYNC only reports changes after the saved MODSEQ, so the
+           * cached flags have to be current */
+          stale = idata->qresync && idata->modseq &&
+            (ctx->hdrs[idx]->read != h.data->read ||
+             ctx->hdrs[idx]->old != h.data->old ||
+             ctx->hdrs[idx]->deleted != h.data->deleted ||
+             ctx->hdrs[idx]->flagged != h.data->flagged ||
+             ctx->hdrs[idx]->replied != h.data->replied);
   	  ctx->hdrs[idx]->index = idx;
   	  /* messages which have not been expunged are ACTIVE (borrowed from mh
   	   * folders) */
@@ -201,6 +393,8 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
           ctx->hdrs[idx]->changed = h.data->changed;
           /*  ctx->hdrs[msgno]->received is restored from mutt_hcache_restore */
           ctx->hdrs[idx]->data = (void *) (h.data);
+          if (stale)
+            imap_hcache_put (idata, ctx->hdrs[idx]);
 
           ctx->msgcount++;
           ctx->size += ctx->hdrs[idx]->content->length;
@@ -236,19 +430,29 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
   {
     mutt_progress_update (&progress, msgno + 1, -1);
 
-    /* we may get notification of new mail while fetching headers */
-    if (msgno + 1 > fetchlast)
+    /* we may get notification of new mail while fetching headers. With
+     * $imap_fetch_chunk_size, the next chunk is requested as soon as we
+     * start on the current one, so the server never waits for us. */
+    while (fetchlast < msgend + 1 &&
+           (msgno + 1 > fetchlast ||
+            (ImapFetchChunkSize > 0 && idata->cmdslots > 2 &&
+             fetchlast < msgno + 1 + ImapFetchChunkSize)))
     {
       char *cmd;
 
-      fetchlast = msgend + 1;
+      if (msgno + 1 > fetchlast)
+        fetchlast = msgno;
+      fetchnext = msgend + 1;
+      if (ImapFetchChunkSize > 0 && fetchnext - fetchlast > ImapFetchChunkSize)
+        fetchnext = fetchlast + ImapFetchChunkSize;
+
       safe_asprintf (&cmd, "FETCH %d:%d (UID FLAGS INTERNALDATE RFC822.SIZE %s)",
-                     msgno + 1, fetchlast, hdrreq);
+                     fetchlast + 1, fetchnext, hdrreq);
       imap_cmd_start (idata, cmd);
       FREE (&cmd);
+      fetchlast = fetchnext;
     }
 
-    rewind (fp);
     memset (&h, 0, sizeof (h));
     h.data = safe_calloc (1, sizeof (IMAP_HEADER_DATA));
 
@@ -264,12 +468,12 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
       if (rc != IMAP_CMD_CONTINUE)
 	break;
 
-      if ((mfhrc = msg_fetch_header (ctx, &h, idata->buf, fp)) == -1)
+      if ((mfhrc = msg_fetch_header (ctx, &h, idata->buf, hdrs)) == -1)
 	continue;
       else if (mfhrc < 0)
 	break;
 
-      if (!ftello (fp))
+      if (hdrs->dptr == hdrs->data)
       {
         dprint (2, (debugfile, "msg_fetch_header: ignoring fetch response with no body\n"));
         mfhrc = -1;
@@ -277,9 +481,6 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
         continue;
       }
 
-      /* make sure we don't get remnants from older larger message headers */
-      fputs ("\n\n", fp);
-
       idx++;
       if (idx > msgend)
       {
@@ -299,6 +500,16 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
       }
 
       ctx->hdrs[idx] = mutt_new_header ();
+      ctx->hdrs[idx]->received = h.received;
+
+      /* NOTE: if Date: header is missing, mutt_read_rfc822_header depends
+       *   on h.received being set */
+      if (msg_parse_header (ctx->hdrs[idx], hdrs, fp) < 0)
+      {
+        mutt_free_header (&ctx->hdrs[idx]);
+        mfhrc = -2;
+        break;
+      }
 
       ctx->hdrs[idx]->index = h.sid - 1;
       /* messages which have not been expunged are ACTIVE (borrowed from mh
@@ -310,17 +521,11 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
       ctx->hdrs[idx]->flagged = h.data->flagged;
       ctx->hdrs[idx]->replied = h.data->replied;
       ctx->hdrs[idx]->changed = h.data->changed;
-      ctx->hdrs[idx]->received = h.received;
       ctx->hdrs[idx]->data = (void *) (h.data);
 
       if (maxuid < h.data->uid)
         maxuid = h.data->uid;
 
-      rewind (fp);
-      /* NOTE: if Date: header is missing, mutt_read_rfc822_header depends
-       *   on h.received being set */
-      ctx->hdrs[idx]->env = mutt_read_rfc822_header (fp, ctx->hdrs[idx],
-        0, 0);
       /* content built as a side-effect of mutt_read_rfc822_header */
       ctx->hdrs[idx]->content->length = h.content_length;
       ctx->size += h.content_length;
@@ -368,10 +573,15 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
   if (idata->uidnext > 1)
     mutt_hcache_store_raw (idata->hcache, "/UIDNEXT", &idata->uidnext,
 			   sizeof (idata->uidnext), imap_hcache_keylen);
+  if (idata->qresync && idata->modseq)
+    save_qresync_state (idata);
 
   imap_hcache_close (idata);
 #endif /* USE_HCACHE */
 
+  for (msgno = oldmsgcount; msgno < ctx->msgcount; msgno++)
+    imap_msn_set (idata, ctx->hdrs[msgno]->index + 1, ctx->hdrs[msgno]);
+
   if (ctx->msgcount > oldmsgcount)
   {
     mx_alloc_memory(ctx);
@@ -384,6 +594,7 @@ int imap_read_headers (IMAP_DATA* idata, int msgbegin, int msgend)
 
 error_out_1:
   safe_fclose (&fp);
+  mutt_buffer_free (&hdrs);
 
 error_out_0:
   FREE (&hdrreq);
@@ -538,6 +749,8 @@ int imap_fetch_message (MESSAGE *msg, CONTEXT *ctx, int msgno)
   if (!fetched || !imap_code (idata->buf))
     goto bail;
 
+  /* the body cache records the size of the committed file */
+  fflush (msg->fp);
   msg_cache_commit (idata, h);
 
   parsemsg:
@@ -595,35 +808,34 @@ bail:
   return -1;
 }
 
-int imap_append_message (CONTEXT *ctx, MESSAGE *msg)
+/* messages collected by imap_append_begin are uploaded at least this often,
+ * so a rejected MULTIAPPEND doesn't take too much with it */
+#define IMAP_APPEND_BATCH 200
+
+static void append_error (IMAP_DATA* idata)
 {
-  IMAP_DATA* idata;
-  FILE *fp;
-  char buf[LONG_STRING];
-  char mbox[LONG_STRING];
-  char mailbox[LONG_STRING];
-  char internaldate[IMAP_DATELEN];
-  char imap_flags[SHORT_STRING];
-  size_t len;
-  progress_t progressbar;
-  size_t sent;
-  int c, last;
-  IMAP_MBOX mx;
-  int rc;
+  char *pc;
 
-  idata = (IMAP_DATA*) ctx->data;
+  dprint (1, (debugfile, "imap_append_message(): command failed: %s\n",
+              idata->buf));
 
-  if (imap_parse_path (ctx->path, &mx))
-    return -1;
+  pc = idata->buf + SEQLEN;
+  SKIPWS (pc);
+  pc = imap_next_word (pc);
+  mutt_error ("%s", pc);
+  mutt_sleep (1);
+}
 
-  imap_fix_path (idata, mx.mbox, mailbox, sizeof (mailbox));
-  if (!*mailbox)
-    strfcpy (mailbox, "INBOX", sizeof (mailbox));
+/* append_prepare: fill in everything APPEND needs to know about msg */
+static int append_prepare (MESSAGE* msg, IMAP_APPEND* app)
+{
+  FILE* fp;
+  int c, last;
 
   if ((fp = fopen (msg->path, "r")) == NULL)
   {
     mutt_perror (msg->path);
-    goto fail;
+    return -1;
   }
 
   /* currently we set the \Seen flag on all messages, but probably we
@@ -632,78 +844,148 @@ int imap_append_message (CONTEXT *ctx, MESSAGE *msg)
    * expensive (it'd be nice if we had the file size passed in already
    * by the code that writes the file, but that's a lot of changes.
    * Ideally we'd have a HEADER structure with flag info here... */
-  for (last = EOF, len = 0; (c = fgetc(fp)) != EOF; last = c)
+  for (last = EOF, app->len = 0; (c = fgetc(fp)) != EOF; last = c)
   {
     if(c == '\n' && last != '\r')
-      len++;
+      app->len++;
 
-    len++;
+    app->len++;
   }
-  rewind (fp);
-
-  mutt_progress_init (&progressbar, _("Uploading message..."),
-		      M_PROGRESS_SIZE, NetInc, len);
+  safe_fclose (&fp);
 
-  imap_munge_mbox_name (idata, mbox, sizeof (mbox), mailbox);
-  imap_make_date (internaldate, msg->received);
+  imap_make_date (app->date, msg->received);
 
-  imap_flags[0] = imap_flags[1] = 0;
+  app->flags[0] = app->flags[1] = 0;
   if (msg->flags.read)
-    safe_strcat (imap_flags, sizeof (imap_flags), " \\Seen");
+    safe_strcat (app->flags, sizeof (app->flags), " \\Seen");
   if (msg->flags.replied)
-    safe_strcat (imap_flags, sizeof (imap_flags), " \\Answered");
+    safe_strcat (app->flags, sizeof (app->flags), " \\Answered");
   if (msg->flags.flagged)
-    safe_strcat (imap_flags, sizeof (imap_flags), " \\Flagged");
+    safe_strcat (app->flags, sizeof (app->flags), " \\Flagged");
   if (msg->flags.draft)
-    safe_strcat (imap_flags, sizeof (imap_flags), " \\Draft");
+    safe_strcat (app->flags, sizeof (app->flags), " \\Draft");
 
-  snprintf (buf, sizeof (buf), "APPEND %s (%s) \"%s\" {%lu}", mbox,
-            imap_flags + 1,
-	    internaldate,
-	    (unsigned long) len);
+  app->path = msg->path;
 
-  imap_cmd_start (idata, buf);
+  return 0;
+}
 
-  do
-    rc = imap_cmd_step (idata);
-  while (rc == IMAP_CMD_CONTINUE);
+/* append_upload: upload count messages to the mailbox of ctx with a single
+ *   APPEND command. More than one message requires MULTIAPPEND (RFC 3502).
+ *   With LITERAL+ or LITERAL- (RFC 7888) the messages are sent without
+ *   waiting for the server to ask for each one. */
+static int append_upload (IMAP_DATA* idata, CONTEXT* ctx, IMAP_APPEND* apps,
+                          int count)
+{
+  FILE *fp;
+  char buf[LONG_STRING];
+  char mbox[LONG_STRING];
+  char mailbox[LONG_STRING];
+  size_t len;
+  size_t total;
+  progress_t progressbar;
+  size_t sent;
+  int c, last;
+  int sync;
+  IMAP_MBOX mx;
+  int n;
+  int rc;
 
-  if (rc != IMAP_CMD_RESPOND)
-  {
-    char *pc;
+  if (imap_parse_path (ctx->path, &mx))
+    return -1;
 
-    dprint (1, (debugfile, "imap_append_message(): command failed: %s\n",
-		idata->buf));
+  imap_fix_path (idata, mx.mbox, mailbox, sizeof (mailbox));
+  FREE (&mx.mbox);
+  if (!*mailbox)
+    strfcpy (mailbox, "INBOX", sizeof (mailbox));
+  imap_munge_mbox_name (idata, mbox, sizeof (mbox), mailbox);
 
-    pc = idata->buf + SEQLEN;
-    SKIPWS (pc);
-    pc = imap_next_word (pc);
-    mutt_error ("%s", pc);
-    mutt_sleep (1);
-    safe_fclose (&fp);
-    goto fail;
-  }
+  for (n = 0, total = 0; n < count; n++)
+    total += apps[n].len;
+
+  mutt_progress_init (&progressbar, count > 1 ? _("Uploading messages...") :
+                      _("Uploading message..."), M_PROGRESS_SIZE, NetInc,
+                      total);
 
-  for (last = EOF, sent = len = 0; (c = fgetc(fp)) != EOF; last = c)
+  for (n = 0, sent = 0; n < count; n++)
   {
-    if (c == '\n' && last != '\r')
-      buf[len++] = '\r';
+    if ((fp = fopen (apps[n].path, "r")) == NULL)
+    {
+      mutt_perror (apps[n].path);
+      /* end the command early: what has been sent so far is complete */
+      if (n)
+      {
+        mutt_socket_write (idata->conn, "\r\n");
+        do
+          rc = imap_cmd_step (idata);
+        while (rc == IMAP_CMD_CONTINUE);
+      }
+      return -1;
+    }
+
+    sync = !(mutt_bit_isset (idata->capabilities, LITERALPLUS) ||
+             (mutt_bit_isset (idata->capabilities, LITERALMINUS)
+              && apps[n].len <= 4096));
+
+    if (!n)
+    {
+      snprintf (buf, sizeof (buf), "APPEND %s (%s) \"%s\" {%lu%s}", mbox,
+                apps[n].flags + 1, apps[n].date, (unsigned long) apps[n].len,
+                sync ? "" : "+");
+      rc = imap_cmd_start (idata, buf);
+    }
+    else
+    {
+      snprintf (buf, sizeof (buf), " (%s) \"%s\" {%lu%s}\r\n",
+                apps[n].flags + 1, apps[n].date, (unsigned long) apps[n].len,
+                sync ? "" : "+");
+      rc = mutt_socket_write (idata->conn, buf);
+    }
+
+    if (rc < 0)
+    {
+      safe_fclose (&fp);
+      return -1;
+    }
+
+    if (sync)
+    {
+      do
+        rc = imap_cmd_step (idata);
+      while (rc == IMAP_CMD_CONTINUE);
+
+      if (rc != IMAP_CMD_RESPOND)
+      {
+        append_error (idata);
+        safe_fclose (&fp);
+        return -1;
+      }
+    }
 
-    buf[len++] = c;
+    for (last = EOF, len = 0; (c = fgetc(fp)) != EOF; last = c)
+    {
+      if (c == '\n' && last != '\r')
+        buf[len++] = '\r';
+
+      buf[len++] = c;
+
+      if (len > sizeof(buf) - 3)
+      {
+        sent += len;
+        flush_buffer(buf, &len, idata->conn);
+        mutt_progress_update (&progressbar, sent, -1);
+      }
+    }
 
-    if (len > sizeof(buf) - 3)
+    if (len)
     {
       sent += len;
       flush_buffer(buf, &len, idata->conn);
-      mutt_progress_update (&progressbar, sent, -1);
     }
+    safe_fclose (&fp);
   }
 
-  if (len)
-    flush_buffer(buf, &len, idata->conn);
-
   mutt_socket_write (idata->conn, "\r\n");
-  safe_fclose (&fp);
 
   do
     rc = imap_cmd_step (idata);
@@ -711,24 +993,98 @@ int imap_append_message (CONTEXT *ctx, MESSAGE *msg)
 
   if (!imap_code (idata->buf))
   {
-    char *pc;
+    append_error (idata);
+    return -1;
+  }
 
-    dprint (1, (debugfile, "imap_append_message(): command failed: %s\n",
-		idata->buf));
-    pc = idata->buf + SEQLEN;
-    SKIPWS (pc);
-    pc = imap_next_word (pc);
-    mutt_error ("%s", pc);
-    mutt_sleep (1);
-    goto fail;
+  return 0;
+}
+
+/* append_flush: upload the messages collected for ctx */
+static int append_flush (IMAP_DATA* idata, CONTEXT* ctx)
+{
+  int rc;
+  int n;
+
+  if (!idata->appendlen)
+    return 0;
+
+  dprint (2, (debugfile, "append_flush: uploading %d messages\n",
+              idata->appendlen));
+  rc = append_upload (idata, ctx, idata->appendq, idata->appendlen);
+
+  for (n = 0; n < idata->appendlen; n++)
+  {
+    unlink (idata->appendq[n].path);
+    FREE (&idata->appendq[n].path);
   }
+  idata->appendlen = 0;
+
+  return rc;
+}
+
+int imap_append_message (CONTEXT *ctx, MESSAGE *msg)
+{
+  IMAP_DATA* idata;
+  IMAP_APPEND app;
+
+  idata = (IMAP_DATA*) ctx->data;
+
+  if (append_prepare (msg, &app) < 0)
+    return -1;
+
+  if (idata->appendctx != ctx)
+    return append_upload (idata, ctx, &app, 1);
+
+  /* keep the message file until imap_append_commit */
+  if (idata->appendlen == idata->appendmax)
+  {
+    idata->appendmax += 32;
+    safe_realloc (&idata->appendq, idata->appendmax * sizeof (IMAP_APPEND));
+  }
+  idata->appendq[idata->appendlen++] = app;
+  msg->path = NULL;
+
+  if (idata->appendlen >= IMAP_APPEND_BATCH)
+    return append_flush (idata, ctx);
 
-  FREE (&mx.mbox);
   return 0;
+}
 
- fail:
-  FREE (&mx.mbox);
-  return -1;
+/* imap_append_begin: from now on, collect the messages appended to ctx so
+ *   they can be uploaded together with MULTIAPPEND. Messages are only sent
+ *   to the server by imap_append_commit, or every IMAP_APPEND_BATCH
+ *   messages. Returns -1 if the server can't do this, in which case every
+ *   message is still uploaded by imap_append_message. */
+int imap_append_begin (CONTEXT* ctx)
+{
+  IMAP_DATA* idata = (IMAP_DATA*) ctx->data;
+
+  if (!idata || idata->appendctx
+      || !mutt_bit_isset (idata->capabilities, MULTIAPPEND))
+    return -1;
+
+  idata->appendctx = ctx;
+
+  return 0;
+}
+
+/* imap_append_commit: upload what imap_append_begin has collected and go
+ *   back to uploading messages one at a time. */
+int imap_append_commit (CONTEXT* ctx)
+{
+  IMAP_DATA* idata = (IMAP_DATA*) ctx->data;
+  int rc;
+
+  if (!idata || idata->appendctx != ctx)
+    return 0;
+
+  rc = append_flush (idata, ctx);
+  FREE (&idata->appendq);
+  idata->appendmax = 0;
+  idata->appendctx = NULL;
+
+  return rc;
 }
 
 /* imap_copy_messages: use server COPY command to copy messages to another
@@ -973,7 +1329,7 @@ int imap_cache_del (IMAP_DATA* idata, HEADER* h)
 
 static int msg_cache_clean_cb (const char* id, body_cache_t* bcache, void* data)
 {
-  unsigned int uv, uid, n;
+  unsigned int uv, uid;
   IMAP_DATA* idata = (IMAP_DATA*)data;
 
   if (sscanf (id, "%u-%u", &uv, &uid) != 2)
@@ -983,13 +1339,8 @@ static int msg_cache_clean_cb (const char* id, body_cache_t* bcache, void* data)
   if (uv != idata->uid_validity)
     mutt_bcache_del (bcache, id);
 
-  /* TODO: presort UIDs, walk in order */
-  for (n = 0; n < idata->ctx->msgcount; n++)
-  {
-    if (uid == HEADER_DATA(idata->ctx->hdrs[n])->uid)
-      return 0;
-  }
-  mutt_bcache_del (bcache, id);
+  if (!imap_msn_uid (idata, uid))
+    mutt_bcache_del (bcache, id);
 
   return 0;
 }
@@ -1002,6 +1353,348 @@ int imap_cache_clean (IMAP_DATA* idata)
   return 0;
 }
 
+/* -- body prefetching --
+ * While mutt waits for a key, imap_prefetch is called each time the server
+ * has sent more, with imap_prefetch_wait sleeping in between. It
+ * opens a second connection to the server, EXAMINEs the selected mailbox
+ * there and keeps a few UID FETCH BODY.PEEK[] commands for unread messages
+ * outstanding, storing the answers in the message cache. It never waits
+ * for the server unless it has already started reading a reply.
+ *
+ * The second connection stays in IMAP_AUTHENTICATED state as far as the
+ * command handler is concerned, so untagged responses about the mailbox
+ * don't touch the context, which belongs to the main connection. */
+
+#define PREFETCH_SLICE 50
+
+static unsigned int prefetch_now (void)
+{
+  struct timeval tv;
+
+  if (gettimeofday (&tv, NULL) < 0)
+    return 0;
+
+  return (unsigned int) tv.tv_sec * 1000 + (unsigned int) (tv.tv_usec / 1000);
+}
+
+static int prefetch_limit (IMAP_DATA* pidata)
+{
+  int limit = ImapPrefetchCount > 0 ? ImapPrefetchCount : 1;
+
+  /* never let cmd_queue drain the pipeline behind our back */
+  if (limit > pidata->cmdslots - 1)
+    limit = pidata->cmdslots - 1;
+
+  return limit;
+}
+
+/* prefetch_next: return the next message worth downloading, or NULL */
+static HEADER* prefetch_next (IMAP_DATA* idata)
+{
+  IMAP_PREFETCH* pf = idata->prefetch;
+  CONTEXT* ctx = idata->ctx;
+  HEADER* h;
+  char id[_POSIX_PATH_MAX];
+
+  /* new or expunged messages: start over, skipping what we've seen */
+  if (pf->msgcount != ctx->msgcount)
+  {
+    pf->cursor = 0;
+    pf->msgcount = ctx->msgcount;
+  }
+
+  while (pf->cursor < ctx->msgcount)
+  {
+    h = ctx->hdrs[pf->cursor++];
+    if (!h || !h->data || HEADER_DATA(h)->prefetched || h->read || h->deleted)
+      continue;
+
+    HEADER_DATA(h)->prefetched = 1;
+    if (ImapPrefetchSize > 0 && h->content
+        && h->content->length > ImapPrefetchSize * 1024L)
+      continue;
+
+    snprintf (id, sizeof (id), "%u-%u", idata->uid_validity,
+              HEADER_DATA(h)->uid);
+    if (mutt_bcache_exists (idata->bcache, id) == 0)
+      continue;
+
+    return h;
+  }
+
+  return NULL;
+}
+
+/* prefetch_open: EXAMINE the selected mailbox on a second connection */
+static int prefetch_open (IMAP_DATA* idata)
+{
+  IMAP_DATA* pidata;
+  char buf[LONG_STRING];
+  char mbox[LONG_STRING];
+  char* pc;
+  unsigned int uidvalidity = 0;
+  int rc;
+
+  if (!(pidata = imap_conn_find (&idata->conn->account, M_IMAP_CONN_NOSELECT))
+      || pidata == idata || pidata->state != IMAP_AUTHENTICATED)
+    return -1;
+
+  pidata->reserved = 1;
+  imap_munge_mbox_name (pidata, mbox, sizeof (mbox), idata->mailbox);
+  snprintf (buf, sizeof (buf), "EXAMINE %s", mbox);
+  imap_cmd_start (pidata, buf);
+  do
+  {
+    rc = imap_cmd_step (pidata);
+    pc = imap_next_word (pidata->buf);
+    if (rc == IMAP_CMD_CONTINUE && !ascii_strncasecmp ("OK [UIDVALIDITY", pc, 14))
+    {
+      pc += 3;
+      pc = imap_next_word (pc);
+      uidvalidity = strtoul (pc, NULL, 10);
+    }
+  }
+  while (rc == IMAP_CMD_CONTINUE);
+
+  if (rc != IMAP_CMD_OK || uidvalidity != idata->uid_validity)
+  {
+    dprint (1, (debugfile, "prefetch_open: could not EXAMINE %s\n", mbox));
+    if (rc == IMAP_CMD_OK)
+      imap_exec (pidata, "CLOSE", IMAP_CMD_FAIL_OK);
+    pidata->reserved = 0;
+    return -1;
+  }
+
+  dprint (2, (debugfile, "prefetch_open: prefetching bodies of %s\n", mbox));
+  idata->prefetch->idata = pidata;
+
+  return 0;
+}
+
+/* prefetch_store: read a body literal into the message cache. Bodies whose
+ *   UID we don't know yet are read and dropped. */
+static int prefetch_store (IMAP_DATA* idata, unsigned int uid, long bytes)
+{
+  IMAP_DATA* pidata = idata->prefetch->idata;
+  char id[_POSIX_PATH_MAX];
+  BUFFER* scratch;
+  FILE* fp = NULL;
+  int rc;
+
+  snprintf (id, sizeof (id), "%u-%u", idata->uid_validity, uid);
+  if (uid)
+    fp = mutt_bcache_put (idata->bcache, id, 1);
+
+  if (!fp)
+  {
+    dprint (2, (debugfile, "prefetch_store: dropping %ld bytes\n", bytes));
+    scratch = mutt_buffer_init (NULL);
+    rc = imap_read_literal_buf (scratch, pidata, bytes);
+    mutt_buffer_free (&scratch);
+    return rc;
+  }
+
+  rc = imap_read_literal (fp, pidata, bytes, NULL);
+  if (fclose (fp) != 0)
+    rc = -1;
+  if (!rc)
+    mutt_bcache_commit (idata->bcache, id);
+
+  return rc;
+}
+
+/* prefetch_read: handle one response from the prefetch connection.
+ *   Returns -1 on fatal errors. */
+static int prefetch_read (IMAP_DATA* idata)
+{
+  IMAP_PREFETCH* pf = idata->prefetch;
+  IMAP_DATA* pidata = pf->idata;
+  unsigned int uid = 0;
+  long bytes;
+  char* pc;
+  int rc;
+
+  rc = imap_cmd_step (pidata);
+  if (pidata->status == IMAP_FATAL)
+    return -1;
+  if (rc != IMAP_CMD_CONTINUE)
+  {
+    /* every command has completed */
+    pf->inflight = 0;
+    return 0;
+  }
+  if (ascii_strncmp (pidata->buf, "* ", 2))
+  {
+    pf->inflight--;
+    return 0;
+  }
+
+  pc = imap_next_word (pidata->buf);
+  pc = imap_next_word (pc);
+  if (ascii_strncasecmp ("FETCH", pc, 5))
+    return 0;
+
+  while (*pc)
+  {
+    pc = imap_next_word (pc);
+    if (pc[0] == '(')
+      pc++;
+    if (!ascii_strncasecmp ("UID", pc, 3))
+    {
+      pc = imap_next_word (pc);
+      uid = strtoul (pc, NULL, 10);
+    }
+    else if (!ascii_strncasecmp ("BODY[]", pc, 6))
+    {
+      pc = imap_next_word (pc);
+      if (imap_get_literal_count (pc, &bytes) < 0
+          || prefetch_store (idata, uid, bytes) < 0)
+        return -1;
+      /* pick up trailing line */
+      if (imap_cmd_step (pidata) != IMAP_CMD_CONTINUE)
+        return -1;
+      pc = pidata->buf;
+    }
+  }
+
+  return 0;
+}
+
+/* prefetch_close: wait for outstanding bodies and give the connection back */
+static void prefetch_close (IMAP_DATA* idata)
+{
+  IMAP_PREFETCH* pf = idata->prefetch;
+  IMAP_DATA* pidata = pf->idata;
+
+  if (!pidata)
+    return;
+
+  while (pf->inflight > 0)
+    if (prefetch_read (idata) < 0)
+      break;
+
+  if (pidata->status != IMAP_FATAL && pidata->state == IMAP_AUTHENTICATED)
+    imap_exec (pidata, "CLOSE", IMAP_CMD_FAIL_OK);
+  pidata->reserved = 0;
+  pf->idata = NULL;
+  pf->inflight = 0;
+}
+
+static int prefetch_step (IMAP_DATA* idata)
+{
+  IMAP_PREFETCH* pf;
+  HEADER* h;
+  char buf[SHORT_STRING];
+  unsigned int start;
+
+  if (!idata->prefetch)
+    idata->prefetch = safe_calloc (1, sizeof (IMAP_PREFETCH));
+  pf = idata->prefetch;
+
+  if (pf->failed || !option (OPTIMAPPREFETCH)
+      || !mutt_bit_isset (idata->capabilities, IMAP4REV1)
+      || !(idata->bcache = msg_cache_open (idata)))
+  {
+    prefetch_close (idata);
+    return 0;
+  }
+
+  /* keep the pipeline full and take whatever the server has sent so far,
+   * but give the keyboard a look-in every PREFETCH_SLICE milliseconds */
+  start = prefetch_now ();
+  for (;;)
+  {
+    while ((!pf->idata || pf->inflight < prefetch_limit (pf->idata))
+           && (h = prefetch_next (idata)))
+    {
+      if (!pf->idata && prefetch_open (idata) < 0)
+        goto fail;
+
+      snprintf (buf, sizeof (buf), "UID FETCH %u BODY.PEEK[]",
+                HEADER_DATA(h)->uid);
+      if (imap_cmd_start (pf->idata, buf) < 0)
+        goto fail;
+      pf->inflight++;
+    }
+
+    if (!pf->inflight || mutt_socket_poll (pf->idata->conn) <= 0
+        || prefetch_now () - start >= PREFETCH_SLICE)
+      break;
+    if (prefetch_read (idata) < 0)
+      goto fail;
+  }
+
+  if (!pf->inflight)
+    prefetch_close (idata);
+
+  return pf->inflight > 0;
+
+ fail:
+  dprint (1, (debugfile, "prefetch_step: giving up on %s\n", idata->mailbox));
+  pf->failed = 1;
+  prefetch_close (idata);
+  return 0;
+}
+
+/* imap_prefetch: download a few bodies for each selected IMAP mailbox.
+ *   Returns nonzero if there is more work to do. */
+int imap_prefetch (void)
+{
+  CONNECTION* conn;
+  IMAP_DATA* idata;
+  int rc = 0;
+
+  for (conn = mutt_socket_head (); conn; conn = conn->next)
+  {
+    if (conn->account.type != M_ACCT_TYPE_IMAP)
+      continue;
+
+    idata = (IMAP_DATA*) conn->data;
+    if (idata && idata->ctx && idata->state >= IMAP_SELECTED
+        && !idata->ctx->closing && prefetch_step (idata))
+      rc = 1;
+  }
+
+  return rc;
+}
+
+/* prefetch_busy: whether conn carries bodies imap_prefetch is waiting for */
+static int prefetch_busy (CONNECTION* conn)
+{
+  CONNECTION* mconn;
+  IMAP_DATA* idata;
+
+  for (mconn = mutt_socket_head (); mconn; mconn = mconn->next)
+  {
+    if (mconn->account.type != M_ACCT_TYPE_IMAP)
+      continue;
+
+    idata = (IMAP_DATA*) mconn->data;
+    if (idata && idata->prefetch && idata->prefetch->idata
+        && idata->prefetch->idata->conn == conn && idata->prefetch->inflight)
+      return 1;
+  }
+
+  return 0;
+}
+
+/* imap_prefetch_wait: sleep for at most timeout milliseconds, until a key
+ *   is pressed or a server sends more of the bodies imap_prefetch asked
+ *   for. See mutt_socket_wait for the return value. */
+int imap_prefetch_wait (int timeout)
+{
+  return mutt_socket_wait (timeout, prefetch_busy);
+}
+
+void imap_prefetch_free (IMAP_DATA* idata)
+{
+  if (!idata->prefetch)
+    return;
+
+  prefetch_close (idata);
+  FREE (&idata->prefetch);
+}
+
 /* imap_add_keywords: concatenate custom IMAP tags to list, if they
  *   appear in the folder flags list. Why wouldn't they? */
 void imap_add_keywords (char* s, HEADER* h, LIST* mailbox_flags, size_t slen)
@@ -1035,6 +1728,47 @@ void imap_free_header_data (IMAP_HEADER_DATA** data)
   }
 }
 
+/* imap_qresync_fetch: collect a FETCH response to SELECT (QRESYNC ...) */
+int imap_qresync_fetch (IMAP_DATA* idata, char* s)
+{
+  IMAP_QRESYNC* qrdata = idata->qrdata;
+  IMAP_HEADER* h;
+
+  if (qrdata->fetchlen == qrdata->fetchmax)
+  {
+    qrdata->fetchmax += 32;
+    safe_realloc (&qrdata->fetch, qrdata->fetchmax * sizeof (IMAP_HEADER));
+  }
+  h = &qrdata->fetch[qrdata->fetchlen];
+  memset (h, 0, sizeof (IMAP_HEADER));
+  h->sid = atoi (s);
+  h->data = safe_calloc (1, sizeof (IMAP_HEADER_DATA));
+
+  if (!(s = strchr (s, '(')) || msg_parse_fetch (h, s + 1) || !h->data->uid)
+  {
+    dprint (1, (debugfile, "imap_qresync_fetch: bad FETCH response\n"));
+    imap_free_header_data (&h->data);
+    return -1;
+  }
+
+  qrdata->fetchlen++;
+  return 0;
+}
+
+void imap_qresync_free (IMAP_QRESYNC** qrdata)
+{
+  int i;
+
+  if (!*qrdata)
+    return;
+
+  for (i = 0; i < (*qrdata)->fetchlen; i++)
+    imap_free_header_data (&(*qrdata)->fetch[i].data);
+  FREE (&(*qrdata)->fetch);
+  mutt_buffer_free (&(*qrdata)->vanished);
+  FREE (qrdata); /* __FREE_CHECKED__ */
+}
+
 /* imap_set_flags: fill out the message header according to the flags from
  *   the server. Expects a flags line of the form "FLAGS (flag flag ...)" */
 char* imap_set_flags (IMAP_DATA* idata, HEADER* h, char* s)
@@ -1082,7 +1816,8 @@ char* imap_set_flags (IMAP_DATA* idata, HEADER* h, char* s)
  *      0 on success
  *     -1 if the string is not a fetch response
  *     -2 if the string is a corrupt fetch response */
-static int msg_fetch_header (CONTEXT* ctx, IMAP_HEADER* h, char* buf, FILE* fp)
+static int msg_fetch_header (CONTEXT* ctx, IMAP_HEADER* h, char* buf,
+                             BUFFER* hdrs)
 {
   IMAP_DATA* idata;
   long bytes;
@@ -1090,6 +1825,11 @@ static int msg_fetch_header (CONTEXT* ctx, IMAP_HEADER* h, char* buf, FILE* fp)
 
   idata = (IMAP_DATA*) ctx->data;
 
+  /* forget the previous message's header, so a response without one
+   * (like an unsolicited FLAGS update) is seen as such */
+  if (hdrs)
+    hdrs->dptr = hdrs->data;
+
   if (buf[0] != '*')
     return rc;
 
@@ -1109,12 +1849,12 @@ static int msg_fetch_header (CONTEXT* ctx, IMAP_HEADER* h, char* buf, FILE* fp)
 
   /* FIXME: current implementation - call msg_parse_fetch - if it returns -2,
    *   read header lines and call it again. Silly. */
-  if ((rc = msg_parse_fetch (h, buf)) != -2 || !fp)
+  if ((rc = msg_parse_fetch (h, buf)) != -2 || !hdrs)
     return rc;
 
   if (imap_get_literal_count (buf, &bytes) == 0)
   {
-    imap_read_literal (fp, idata, bytes, NULL);
+    imap_read_literal_buf (hdrs, idata, bytes);
 
     /* we may have other fields of the FETCH _after_ the literal
      * (eg Domino puts FLAGS here). Nothing wrong with that, either.
@@ -1136,6 +1876,31 @@ static int msg_fetch_header (CONTEXT* ctx, IMAP_HEADER* h, char* buf, FILE* fp)
   return rc;
 }
 
+/* msg_parse_header: build h->env (and h->content) from the header block
+ *   msg_fetch_header collected in hdrs. fp is a scratch file, only used
+ *   where fmemopen isn't available. */
+static int msg_parse_header (HEADER* h, BUFFER* hdrs, FILE* fp)
+{
+#ifdef HAVE_FMEMOPEN
+  if (!(fp = fmemopen (hdrs->data, hdrs->dptr - hdrs->data, "r")))
+  {
+    mutt_perror ("fmemopen");
+    return -1;
+  }
+  h->env = mutt_read_rfc822_header (fp, h, 0, 0);
+  safe_fclose (&fp);
+#else
+  rewind (fp);
+  fwrite (hdrs->data, 1, hdrs->dptr - hdrs->data, fp);
+  /* make sure we don't get remnants from older larger message headers */
+  fputs ("\n\n", fp);
+  rewind (fp);
+  h->env = mutt_read_rfc822_header (fp, h, 0, 0);
+#endif
+
+  return 0;
+}
+
 /* msg_parse_fetch: handle headers returned from header fetch */
 static int msg_parse_fetch (IMAP_HEADER *h, char *s)
 {
@@ -1162,6 +1927,12 @@ static int msg_parse_fetch (IMAP_HEADER *h, char *s)
 
       s = imap_next_word (s);
     }
+    else if (ascii_strncasecmp ("MODSEQ", s, 6) == 0)
+    {
+      /* CONDSTORE "MODSEQ (n)": only HIGHESTMODSEQ is tracked */
+      s = imap_next_word (s);
+      s = imap_next_word (s);
+    }
     else if (ascii_strncasecmp ("INTERNALDATE", s, 12) == 0)
     {
       s += 12;
@@ -1300,6 +2071,6 @@ static char* msg_parse_flags (IMAP_HEADER* h, char* s)
 static void flush_buffer(char *buf, size_t *len, CONNECTION *conn)
 {
   buf[*len] = '\0';
-  mutt_socket_write_n(conn, buf, *len);
+  mutt_socket_buffer (conn, buf, *len);
   *len = 0;
 }
@@ -35,6 +35,10 @@ typedef struct imap_header_data
   unsigned int changed : 1;
 
   unsigned int parsed : 1;
+  /* restored by QRESYNC without FLAGS, so keywords are unknown */
+  unsigned int nokeywords : 1;
+  /* already looked at by the body prefetcher */
+  unsigned int prefetched : 1;
 
   unsigned int uid;	/* 32-bit Message UID */
   LIST *keywords;
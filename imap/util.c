@@ -393,12 +393,15 @@ void imap_free_idata (IMAP_DATA** idata)
     return;
 
   FREE (&(*idata)->capstr);
+  FREE (&(*idata)->notifyset);
+  FREE (&(*idata)->watch);
   mutt_free_list (&(*idata)->flags);
   imap_mboxcache_free (*idata);
   mutt_buffer_free(&(*idata)->cmdbuf);
   FREE (&(*idata)->buf);
   mutt_bcache_close (&(*idata)->bcache);
   FREE (&(*idata)->cmds);
+  imap_msn_free (*idata);
   FREE (idata);		/* __FREE_CHECKED__ */
 }
 
@@ -594,6 +597,314 @@ void imap_make_date (char *buf, time_t timestamp)
       (int) tz / 60, (int) abs ((int) tz) % 60);
 }
 
+static int seqset_cmp (const void* a, const void* b)
+{
+  unsigned int ua = *(const unsigned int*) a;
+  unsigned int ub = *(const unsigned int*) b;
+
+  return ua < ub ? -1 : ua > ub;
+}
+
+/* imap_seqset_parse: turn a UID set such as "1:4,7,9:11" (without '*')
+ *   into an array of disjoint, sorted, inclusive ranges stored as lo/hi
+ *   pairs. Returns the number of ranges; *ranges must be
+ *   freed by the caller. */
+int imap_seqset_parse (const char* s, unsigned int** ranges)
+{
+  unsigned int lo, hi, t;
+  char* end;
+  int n = 0, max = 0;
+
+  *ranges = NULL;
+
+  while (s && *s)
+  {
+    lo = hi = (unsigned int) strtoul (s, &end, 10);
+    if (end == s)
+      break;
+    s = end;
+    if (*s == ':')
+    {
+      s++;
+      hi = (unsigned int) strtoul (s, &end, 10);
+      if (end == s)
+	break;
+      s = end;
+      if (lo > hi)
+	t = lo, lo = hi, hi = t;
+    }
+    if (n == max)
+    {
+      max += 32;
+      safe_realloc (ranges, 2 * max * sizeof (unsigned int));
+    }
+    (*ranges)[2 * n] = lo;
+    (*ranges)[2 * n + 1] = hi;
+    n++;
+    if (*s != ',')
+      break;
+    s++;
+  }
+
+  if (n > 1)
+  {
+    int i, j;
+
+    /* sort and merge overlapping or adjacent ranges */
+    qsort (*ranges, n, 2 * sizeof (unsigned int), seqset_cmp);
+    for (i = 0, j = 1; j < n; j++)
+    {
+      if ((*ranges)[2 * j] <= (*ranges)[2 * i + 1] + 1)
+      {
+	if ((*ranges)[2 * j + 1] > (*ranges)[2 * i + 1])
+	  (*ranges)[2 * i + 1] = (*ranges)[2 * j + 1];
+      }
+      else
+      {
+	i++;
+	(*ranges)[2 * i] = (*ranges)[2 * j];
+	(*ranges)[2 * i + 1] = (*ranges)[2 * j + 1];
+      }
+    }
+    n = i + 1;
+  }
+
+  return n;
+}
+
+/* imap_seqset_member: is uid in a set returned by imap_seqset_parse? */
+int imap_seqset_member (const unsigned int* ranges, int n, unsigned int uid)
+{
+  int lo = 0, hi = n - 1, mid;
+
+  while (lo <= hi)
+  {
+    mid = (lo + hi) / 2;
+    if (uid < ranges[2 * mid])
+      hi = mid - 1;
+    else if (uid > ranges[2 * mid + 1])
+      lo = mid + 1;
+    else
+      return 1;
+  }
+
+  return 0;
+}
+
+/* imap_seqset_make: append the UIDs in uids (which is sorted in place) to
+ *   buf in compressed sequence set form. */
+void imap_seqset_make (BUFFER* buf, unsigned int* uids, int n)
+{
+  int i, j;
+
+  qsort (uids, n, sizeof (unsigned int), seqset_cmp);
+
+  for (i = 0; i < n; i = j + 1)
+  {
+    for (j = i; j + 1 < n && uids[j + 1] <= uids[j] + 1; j++)
+      ;
+    if (i)
+      mutt_buffer_addch (buf, ',');
+    if (uids[i] == uids[j])
+      mutt_buffer_printf (buf, "%u", uids[i]);
+    else
+      mutt_buffer_printf (buf, "%u:%u", uids[i], uids[j]);
+  }
+}
+
+/* The MSN index holds the headers of the selected mailbox in sequence number
+ * order, which is also UID order, so a header can be found by either in at
+ * most O(log n). An EXPUNGE only takes its message out of a Fenwick tree
+ * counting the live slots; the slots are compacted and the headers
+ * renumbered in one pass by imap_msn_compact. Slots of headers which could
+ * not be fetched are NULL, and become ExpungedSlot if they are expunged. */
+
+static HEADER ExpungedSlot;
+
+static void msn_tree_build (IMAP_DATA* idata)
+{
+  int i, j;
+
+  /* tree[i] counts the live slots in (i - (i & -i), i] */
+  idata->msn_tree = safe_malloc ((idata->msn_count + 1) * sizeof (int));
+  for (i = 1; i <= idata->msn_count; i++)
+    idata->msn_tree[i] = 1;
+  for (i = 1; i <= idata->msn_count; i++)
+    if ((j = i + (i & -i)) <= idata->msn_count)
+      idata->msn_tree[j] += idata->msn_tree[i];
+}
+
+/* msn_pos: the slot holding sequence number msn, or -1 */
+static int msn_pos (IMAP_DATA* idata, int msn)
+{
+  int pos = 0, step;
+
+  if (msn < 1 || msn > idata->msn_count - idata->msn_gone)
+    return -1;
+  if (!idata->msn_tree)
+    return msn - 1;
+
+  for (step = 1; step * 2 <= idata->msn_count; step *= 2)
+    ;
+  for (; step; step /= 2)
+  {
+    if (pos + step <= idata->msn_count && idata->msn_tree[pos + step] < msn)
+    {
+      pos += step;
+      msn -= idata->msn_tree[pos];
+    }
+  }
+
+  return pos;
+}
+
+/* msn_uid_pos: the first slot with a UID not below uid */
+static int msn_uid_pos (IMAP_DATA* idata, unsigned int uid)
+{
+  int lo = 0, hi = idata->msn_count, mid, cur;
+
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    for (cur = mid; cur < hi && (!idata->msn_index[cur] ||
+                                 idata->msn_index[cur] == &ExpungedSlot); cur++)
+      ;
+    if (cur == hi)
+      hi = mid;
+    else if (HEADER_DATA(idata->msn_index[cur])->uid < uid)
+      lo = cur + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+static void msn_drop (IMAP_DATA* idata, int pos)
+{
+  HEADER* h = idata->msn_index[pos];
+  int i;
+
+  if (!idata->msn_tree)
+    msn_tree_build (idata);
+  for (i = pos + 1; i <= idata->msn_count; i += i & -i)
+    idata->msn_tree[i]--;
+  idata->msn_gone++;
+
+  /* a NULL slot stays as a placeholder until imap_msn_compact */
+  if (h)
+    h->index = -1;
+  else
+    idata->msn_index[pos] = &ExpungedSlot;
+}
+
+/* imap_msn_set: record h as the header of sequence number msn */
+void imap_msn_set (IMAP_DATA* idata, int msn, HEADER* h)
+{
+  imap_msn_compact (idata);
+
+  if (msn > idata->msn_max)
+  {
+    idata->msn_max = MAX (msn, 2 * idata->msn_max);
+    safe_realloc (&idata->msn_index, idata->msn_max * sizeof (HEADER*));
+  }
+  for (; idata->msn_count < msn; idata->msn_count++)
+    idata->msn_index[idata->msn_count] = NULL;
+
+  idata->msn_index[msn - 1] = h;
+}
+
+/* imap_msn_get: the header of sequence number msn, or NULL */
+HEADER* imap_msn_get (IMAP_DATA* idata, int msn)
+{
+  int pos = msn_pos (idata, msn);
+
+  return pos < 0 ? NULL : idata->msn_index[pos];
+}
+
+/* imap_msn_uid: the live header with UID uid, or NULL */
+HEADER* imap_msn_uid (IMAP_DATA* idata, unsigned int uid)
+{
+  int pos = msn_uid_pos (idata, uid);
+  HEADER* h = NULL;
+
+  for (; pos < idata->msn_count; pos++)
+    if ((h = idata->msn_index[pos]) && h != &ExpungedSlot)
+      break;
+  if (pos == idata->msn_count || HEADER_DATA(h)->uid != uid || h->index < 0)
+    return NULL;
+
+  return h;
+}
+
+/* imap_msn_expunge: remove sequence number msn, as for EXPUNGE. The
+ *   header's index is set to -1 for imap_expunge_mailbox. */
+void imap_msn_expunge (IMAP_DATA* idata, int msn)
+{
+  int pos = msn_pos (idata, msn);
+
+  if (pos >= 0)
+    msn_drop (idata, pos);
+}
+
+/* imap_msn_vanished: remove the messages with UIDs in ranges (see
+ *   imap_seqset_parse), as for VANISHED. Returns the number removed. */
+int imap_msn_vanished (IMAP_DATA* idata, const unsigned int* ranges, int n)
+{
+  HEADER* h;
+  int i, pos, rc = 0;
+
+  for (i = 0; i < n; i++)
+  {
+    for (pos = msn_uid_pos (idata, ranges[2 * i]); pos < idata->msn_count; pos++)
+    {
+      h = idata->msn_index[pos];
+      if (!h || h == &ExpungedSlot || h->index < 0)
+        continue;
+      if (HEADER_DATA(h)->uid > ranges[2 * i + 1])
+        break;
+      msn_drop (idata, pos);
+      rc++;
+    }
+  }
+
+  return rc;
+}
+
+/* imap_msn_compact: drop expunged slots and renumber the remaining headers.
+ *   Must be done before the headers' index is relied upon. */
+void imap_msn_compact (IMAP_DATA* idata)
+{
+  HEADER* h;
+  int i, j;
+
+  if (!idata->msn_gone)
+    return;
+
+  for (i = j = 0; i < idata->msn_count; i++)
+  {
+    h = idata->msn_index[i];
+    if (h == &ExpungedSlot || (h && h->index < 0))
+      continue;
+    if (h)
+      h->index = j;
+    idata->msn_index[j++] = h;
+  }
+
+  dprint (2, (debugfile, "imap_msn_compact: %d messages expunged\n",
+              idata->msn_gone));
+  idata->msn_count = j;
+  idata->msn_gone = 0;
+  FREE (&idata->msn_tree);
+}
+
+void imap_msn_free (IMAP_DATA* idata)
+{
+  FREE (&idata->msn_index);
+  FREE (&idata->msn_tree);
+  idata->msn_max = idata->msn_count = idata->msn_gone = 0;
+}
+
 /* imap_qualify_path: make an absolute IMAP folder target, given IMAP_MBOX
  *   and relative path. */
 void imap_qualify_path (char *dest, size_t len, IMAP_MBOX *mx, char* path)
@@ -754,7 +1065,7 @@ void imap_keepalive (void)
 
       idata = (IMAP_DATA*) conn->data;
 
-      if (idata->state >= IMAP_AUTHENTICATED
+      if (idata->state >= IMAP_AUTHENTICATED && !idata->reserved
 	  && time(NULL) >= idata->lastread + ImapKeepalive)
       {
 	if (idata->ctx)
@@ -420,6 +420,9 @@ int mutt_add_to_rx_list (RX_LIST **list, const char *s, int flags, BUFFER *err)
     return -1;
   }
 
+  if (*list)
+    mutt_free_rx_matcher (&(*list)->matcher);
+
   /* check to make sure the item is not already on this list */
   for (last = *list; last; last = last->next)
   {
@@ -469,6 +472,9 @@ static int add_to_spam_list (SPAM_LIST **list, const char *pat, const char *temp
     return -1;
   }
 
+  if (*list)
+    mutt_free_rx_matcher (&(*list)->matcher);
+
   /* check to make sure the item is not already on this list */
   for (last = *list; last; last = last->next)
   {
@@ -542,6 +548,7 @@ static int remove_from_spam_list (SPAM_LIST **list, const char *pat)
   spam = *list;
   if (!spam)
     return 0;
+  mutt_free_rx_matcher (&spam->matcher);
   if (spam->rx && !mutt_strcmp(spam->rx->pattern, pat))
   {
     *list = spam->next;
@@ -1139,6 +1139,15 @@ struct option_t MuttVars[] = {
    ** it polls for new mail just as if you had issued individual ``$mailboxes''
    ** commands.
    */
+#ifdef USE_ZLIB
+  { "imap_deflate",		DT_BOOL, R_NONE, OPTIMAPDEFLATE, 1 },
+  /*
+  ** .pp
+  ** When \fIset\fP, mutt will compress the traffic on IMAP connections
+  ** with the COMPRESS=DEFLATE extension (RFC 4978), if the server supports
+  ** it. This mostly helps on slow links.
+  */
+#endif
   { "imap_delim_chars",		DT_STR, R_NONE, UL &ImapDelimChars, UL "/." },
   /*
   ** .pp
@@ -1146,6 +1155,14 @@ struct option_t MuttVars[] = {
   ** as folder separators for displaying IMAP paths. In particular it
   ** helps in using the ``='' shortcut for your \fIfolder\fP variable.
   */
+  { "imap_fetch_chunk_size",	DT_NUM, R_NONE, UL &ImapFetchChunkSize, 1000 },
+  /*
+  ** .pp
+  ** When set to a value greater than 0, new headers are downloaded in
+  ** groups of this many messages per FETCH command, with the next group
+  ** requested while the current one is still arriving. When \fIunset\fP
+  ** (0), all new headers are requested with a single command.
+  */
   { "imap_headers",	DT_STR, R_INDEX, UL &ImapHeaders, UL 0},
   /*
   ** .pp
@@ -1169,6 +1186,19 @@ struct option_t MuttVars[] = {
   ** to mutt's implementation. If your connection seems to freeze
   ** up periodically, try unsetting this.
   */
+  { "imap_idle_mailboxes",      DT_RX,   R_NONE, UL &ImapIdleMailboxes, 0 },
+  /*
+  ** .pp
+  ** IMAP mailboxes in your $$mailboxes list whose path matches this
+  ** regular expression are watched for new mail with IDLE on a connection
+  ** of their own, instead of being polled with STATUS every $$mail_check
+  ** seconds. Mutt only asks for the STATUS of such a mailbox after the
+  ** server has reported activity in it. Since each of these mailboxes
+  ** takes up a connection, keep this to the few folders you want to hear
+  ** about first. This has no effect on servers which support NOTIFY
+  ** (RFC 5465): those push changes in all of your mailboxes over the
+  ** connection mutt already has.
+  */
   { "imap_keepalive",           DT_NUM,  R_NONE, UL &ImapKeepalive, 300 },
   /*
   ** .pp
@@ -1233,6 +1263,49 @@ struct option_t MuttVars[] = {
   ** .pp
   ** \fBNote:\fP Changes to this variable have no effect on open connections.
   */
+  { "imap_poll_timeout", DT_NUM,  R_NONE, UL &ImapPollTimeout, 0 },
+  /*
+  ** .pp
+  ** This variable specifies the maximum amount of time in seconds that mutt
+  ** will wait for a server to answer when polling IMAP mailboxes for new
+  ** mail, before giving up and closing the connection. The servers of all
+  ** mailboxes are polled at the same time, so a slow server only delays
+  ** its own mailboxes. The connection of the open mailbox is never given
+  ** up on, since that would close the mailbox. Set to 0 to wait forever.
+  */
+  { "imap_prefetch",		DT_BOOL, R_NONE, OPTIMAPPREFETCH, 0 },
+  /*
+  ** .pp
+  ** When \fIset\fP, mutt downloads the bodies of unread messages in the
+  ** open IMAP mailbox into the $$message_cachedir while it is waiting for
+  ** you to press a key, so that they open without delay later. The
+  ** messages are fetched over a second connection to the server, leaving
+  ** the one used by the index free. Has no effect unless
+  ** $$message_cachedir is set.
+  ** .pp
+  ** See also $$imap_prefetch_count and $$imap_prefetch_size.
+  */
+  { "imap_prefetch_count",	DT_NUM, R_NONE, UL &ImapPrefetchCount, 4 },
+  /*
+  ** .pp
+  ** The number of message bodies $$imap_prefetch requests from the server
+  ** at once. It is limited by $$imap_pipeline_depth.
+  */
+  { "imap_prefetch_size",	DT_NUM, R_NONE, UL &ImapPrefetchSize, 512 },
+  /*
+  ** .pp
+  ** Messages larger than this many kilobytes are not downloaded by
+  ** $$imap_prefetch. 0 means no limit.
+  */
+  { "imap_server_sort",	DT_BOOL, R_NONE, OPTIMAPSERVERSORT, 0 },
+  /*
+  ** .pp
+  ** When \fIset\fP, mutt asks the IMAP server to sort the open mailbox if
+  ** it supports the SORT extension and can order messages the way $$sort
+  ** and $$sort_aux ask for (``date'', ``date-received'', ``size'',
+  ** ``subject'', and with SORT=DISPLAY also ``from'' and ``to''). Other
+  ** sort methods, and threads, are still handled by mutt.
+  */
   { "imap_servernoise",		DT_BOOL, R_NONE, OPTIMAPSERVERNOISE, 1 },
   /*
   ** .pp
@@ -1517,6 +1590,27 @@ struct option_t MuttVars[] = {
   ** every once in a while, since it can be a little slow
   ** (especially for large folders).
   */
+#ifdef USE_ZLIB
+  { "message_cache_compress", DT_BOOL, R_NONE, OPTMESSAGECACHECOMPRESS, 0 },
+  /*
+  ** .pp
+  ** When \fIset\fP, messages are compressed with gzip when they are stored
+  ** in the $$message_cachedir, which typically makes text mail take less
+  ** than half the space. They are uncompressed to a temporary file when
+  ** read. Messages cached before this was set are still read as they are.
+  */
+#endif
+  { "message_cache_size", DT_NUM, R_NONE, UL &MessageCacheSize, 0 },
+  /*
+  ** .pp
+  ** The maximum size of the message cache in $$message_cachedir, in
+  ** megabytes. When a message is added to a full cache, the least recently
+  ** read messages of all accounts and folders are removed until it fits
+  ** again. A value of 0 means the cache is never trimmed.
+  ** .pp
+  ** Sizes are tracked in an index file in $$message_cachedir. Messages
+  ** removed by hand are dropped from it when mutt next tries to read them.
+  */
   { "message_cachedir",	DT_PATH,	R_NONE,	UL &MessageCachedir, 0 },
   /*
   ** .pp
@@ -2151,6 +2245,18 @@ struct option_t MuttVars[] = {
   ** fairly secure machine, because the superuser can read your muttrc
   ** even if you are the only one who can read the file.
   */
+  { "pop_pipeline_depth", DT_NUM, R_NONE, UL &PopPipelineDepth, 15 },
+  /*
+  ** .pp
+  ** Controls the number of message headers or messages mutt requests from
+  ** a POP server before waiting for the first of them to arrive. This is
+  ** only done with servers which announce the ``\fCPIPELINING\fP''
+  ** capability, and greatly speeds up loading large mailboxes over slow
+  ** links. Set it to 0 to send one command at a time.
+  ** .pp
+  ** If the connection is lost while commands are pipelined, mutt reconnects
+  ** and continues without pipelining for the rest of the session.
+  */
   { "pop_reconnect",	DT_QUAD, R_NONE, OPT_POPRECONNECT, M_ASKYES },
   /*
   ** .pp
@@ -2930,6 +3036,17 @@ struct option_t MuttVars[] = {
   ** fairly secure machine, because the superuser can read your muttrc even
   ** if you are the only one who can read the file.
   */
+  { "smtp_session_timeout", DT_NUM, R_NONE, UL &SmtpSessionTimeout, 60 },
+  /*
+  ** .pp
+  ** After sending a message via SMTP, mutt keeps the connection open
+  ** for this many seconds, so that the next message (eg the rest of a
+  ** batch of bounces) can go out without another greeting, TLS
+  ** negotiation and authentication. The session is reset with RSET
+  ** before it is reused. If the server has dropped it in the meantime,
+  ** mutt reconnects. A value of 0 closes the connection after every
+  ** message.
+  */
   { "smtp_url",		DT_STR, R_NONE, UL &SmtpUrl, UL 0 },
   /*
   ** .pp
@@ -430,6 +430,43 @@ int km_dokey (int menu)
   {
     i = Timeout > 0 ? Timeout : 60;
 #ifdef USE_IMAP
+    /* download message bodies while waiting, sleeping until either the
+     * server or the keyboard has something for us */
+    if (option (OPTIMAPPREFETCH))
+    {
+      time_t start = time (NULL);
+
+      while (imap_prefetch ())
+      {
+	/* keys curses has already read never wake up select() */
+	timeout (0);
+	tmp = mutt_getch ();
+	timeout (-1);
+	if (tmp.ch != -2 || SigWinch)
+	  goto gotkey;
+	if (time (NULL) >= start + i)
+	  break;
+	imap_prefetch_wait ((start + i - time (NULL)) * 1000);
+	if (SigInt)
+	{
+	  mutt_query_exit ();
+	  tmp.ch = -1;
+	  tmp.op = OP_NULL;
+	  goto gotkey;
+	}
+      }
+
+      /* $timeout expired while we were busy */
+      if ((i -= time (NULL) - start) < 1)
+      {
+	if (menu == MENU_EDITOR)
+	  continue;
+	tmp.ch = -2;
+	tmp.op = 0;
+	goto gotkey;
+      }
+    }
+
     /* keepalive may need to run more frequently than Timeout allows */
     if (ImapKeepalive)
     {
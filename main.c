@@ -852,6 +852,9 @@ int main (int argc, char **argv)
     if (!option (OPTNOCURSES))
       mutt_flushinp ();
     ci_send_message (SENDPOSTPONED, NULL, NULL, NULL, NULL);
+#ifdef USE_SMTP
+    mutt_smtp_close ();
+#endif
     mutt_endwin (NULL);
   }
   else if (subject || msg || sendflags || draftFile || includeFile || attach ||
@@ -998,6 +1001,9 @@ int main (int argc, char **argv)
     }
 
     rv = ci_send_message (sendflags, msg, tempfile, NULL, NULL);
+#ifdef USE_SMTP
+    mutt_smtp_close ();
+#endif
 
     if (!option (OPTNOCURSES))
       mutt_endwin (NULL);
@@ -1065,6 +1071,9 @@ int main (int argc, char **argv)
 #ifdef USE_IMAP
     imap_logout_all ();
 #endif
+#ifdef USE_SMTP
+    mutt_smtp_close ();
+#endif
 #ifdef USE_SASL
     mutt_sasl_done ();
 #endif
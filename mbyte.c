@@ -54,12 +54,12 @@ void mutt_set_charset (char *charset)
   charset_is_ja = 0;
   if (charset_to_utf8 != (iconv_t)(-1))
   {
-    iconv_close (charset_to_utf8);
+    mutt_iconv_close (charset_to_utf8);
     charset_to_utf8 = (iconv_t)(-1);
   }
   if (charset_from_utf8 != (iconv_t)(-1))
   {
-    iconv_close (charset_from_utf8);
+    mutt_iconv_close (charset_from_utf8);
     charset_from_utf8 = (iconv_t)(-1);
   }
 #endif
@@ -359,11 +359,16 @@ enum
   OPTIGNORELISTREPLYTO,
 #ifdef USE_IMAP
   OPTIMAPCHECKSUBSCRIBED,
+# ifdef USE_ZLIB
+  OPTIMAPDEFLATE,
+# endif
   OPTIMAPIDLE,
   OPTIMAPLSUB,
   OPTIMAPPASSIVE,
   OPTIMAPPEEK,
+  OPTIMAPPREFETCH,
   OPTIMAPSERVERNOISE,
+  OPTIMAPSERVERSORT,
 #endif
 #if defined(USE_SSL)
 # ifndef USE_SSL_GNUTLS
@@ -391,6 +396,9 @@ enum
   OPTMENUMOVEOFF,	/* allow menu to scroll past last entry */
 #if defined(USE_IMAP) || defined(USE_POP)
   OPTMESSAGECACHECLEAN,
+# ifdef USE_ZLIB
+  OPTMESSAGECACHECOMPRESS,
+# endif
 #endif
   OPTMETAKEY,		/* interpret ALT-x as ESC-x */
   OPTMETOO,
@@ -534,9 +542,12 @@ typedef struct list_t
   struct list_t *next;
 } LIST;
 
+struct rx_matcher;
+
 typedef struct rx_list_t
 {
   REGEXP *rx;
+  struct rx_matcher *matcher;	/* all entries combined, kept in the head */
   struct rx_list_t *next;
 } RX_LIST;
 
@@ -545,6 +556,7 @@ typedef struct spam_list_t
   REGEXP *rx;
   int     nmatch;
   char   *template;
+  struct rx_matcher *matcher;	/* all entries combined, kept in the head */
   struct spam_list_t *next;
 } SPAM_LIST;
 
@@ -554,6 +566,7 @@ typedef struct spam_list_t
 void mutt_free_list (LIST **);
 void mutt_free_rx_list (RX_LIST **);
 void mutt_free_spam_list (SPAM_LIST **);
+void mutt_free_rx_matcher (struct rx_matcher **);
 LIST *mutt_copy_list (LIST *);
 int mutt_matches_ignore (const char *, LIST *);
 
@@ -759,6 +772,9 @@ typedef struct header
   int msgno;			/* number displayed to the user */
   int virtual;			/* virtual message number */
   int score;
+  unsigned char *score_cache;	/* cached score rule results, see score.c */
+  unsigned int score_gen;	/* score rule generation of score_cache */
+  short score_slots;		/* number of rules held in score_cache */
   ENVELOPE *env;		/* envelope information */
   BODY *content;		/* list of MIME parts */
   char *path;
@@ -831,10 +847,12 @@ typedef struct pattern_t
   unsigned int stringmatch : 1;
   unsigned int groupmatch : 1;
   unsigned int ign_case : 1;		/* ignore case for local stringmatch searches */
+  unsigned int imapmatch : 1;		/* IMAP search left the result in h->matched */
   int min;
   int max;
   struct pattern_t *next;
   struct pattern_t *child;		/* arguments to logical op */
+  char *literal;			/* ASCII substring every match contains */
   union 
   {
     regex_t *rx;
@@ -44,6 +44,7 @@ typedef struct
   char *pattern;	/* printable version */
   regex_t *rx; 		/* compiled expression */
   int not;		/* do not match */
+  int flags;		/* flags rx was compiled with */
 } REGEXP;
 
 WHERE REGEXP Mask;
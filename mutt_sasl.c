@@ -615,6 +615,10 @@ static int mutt_sasl_conn_poll (CONNECTION* conn)
   SASL_DATA* sasldata = conn->sockdata;
   int rc;
 
+  /* decoded input left over from the last read */
+  if (sasldata->blen > sasldata->bpos)
+    return 1;
+
   conn->sockdata = sasldata->sockdata;
   rc = sasldata->msasl_poll (conn);
   conn->sockdata = sasldata;
@@ -47,6 +47,9 @@
 #include <string.h>
 #include <errno.h>
 
+/* seconds a server may keep us waiting before socket_stall says so */
+#define M_SOCK_STALL 3
+
 /* support for multiple socket connections */
 static CONNECTION *Connections = NULL;
 
@@ -82,6 +85,8 @@ int mutt_socket_close (CONNECTION* conn)
 
   conn->fd = -1;
   conn->ssf = 0;
+  FREE (&conn->outbuf);
+  conn->outlen = 0;
 
   return rc;
 }
@@ -109,25 +114,16 @@ int mutt_socket_read (CONNECTION* conn, char* buf, size_t len)
   return rc;
 }
 
-int mutt_socket_write_d (CONNECTION *conn, const char *buf, int len, int dbg)
+/* socket_write: hand count bytes to the connection, which may take them in
+ *   several goes. Closes the connection on error. */
+static int socket_write (CONNECTION* conn, const char* buf, size_t count)
 {
   int rc;
-  int sent = 0;
-
-  dprint (dbg, (debugfile,"%d> %s", conn->fd, buf));
-
-  if (conn->fd < 0)
-  {
-    dprint (1, (debugfile, "mutt_socket_write: attempt to write to closed connection\n"));
-    return -1;
-  }
+  size_t sent = 0;
 
-  if (len < 0)
-    len = mutt_strlen (buf);
-  
-  while (sent < len)
+  while (sent < count)
   {
-    if ((rc = conn->conn_write (conn, buf + sent, len - sent)) < 0)
+    if ((rc = conn->conn_write (conn, buf + sent, count - sent)) < 0)
     {
       dprint (1, (debugfile,
                   "mutt_socket_write: error writing (%s), closing socket\n",
@@ -137,10 +133,10 @@ int mutt_socket_write_d (CONNECTION *conn, const char *buf, int len, int dbg)
       return -1;
     }
 
-    if (rc < len - sent)
+    if (rc < count - sent)
       dprint (3, (debugfile,
                   "mutt_socket_write: short write (%d of %d bytes)\n", rc,
-                  len - sent));
+                  (int) (count - sent)));
     
     sent += rc;
   }
@@ -148,6 +144,81 @@ int mutt_socket_write_d (CONNECTION *conn, const char *buf, int len, int dbg)
   return sent;
 }
 
+int mutt_socket_write_d (CONNECTION *conn, const char *buf, int len, int dbg)
+{
+  if (conn->outlen)
+  {
+    if ((len = mutt_socket_buffer_d (conn, buf, len, dbg)) < 0
+        || mutt_socket_flush (conn) < 0)
+      return -1;
+    return len;
+  }
+
+  dprint (dbg, (debugfile,"%d> %s", conn->fd, buf));
+
+  if (conn->fd < 0)
+  {
+    dprint (1, (debugfile, "mutt_socket_write: attempt to write to closed connection\n"));
+    return -1;
+  }
+
+  if (len < 0)
+    len = mutt_strlen (buf);
+
+  return socket_write (conn, buf, len);
+}
+
+/* mutt_socket_buffer_d: like mutt_socket_write_d, but collect the data in
+ *   the connection's output buffer, so that many small writes (eg a message
+ *   line by line) go out as a few large ones. The buffer is sent when it
+ *   fills up, by mutt_socket_flush and by the next mutt_socket_write or
+ *   read. */
+int mutt_socket_buffer_d (CONNECTION *conn, const char *buf, int len, int dbg)
+{
+  dprint (dbg, (debugfile,"%d> %s", conn->fd, buf));
+
+  if (conn->fd < 0)
+  {
+    dprint (1, (debugfile, "mutt_socket_buffer: attempt to write to closed connection\n"));
+    return -1;
+  }
+
+  if (len < 0)
+    len = mutt_strlen (buf);
+
+  if (conn->outlen + len > M_SOCK_OUTBUFSIZE)
+  {
+    if (mutt_socket_flush (conn) < 0)
+      return -1;
+    /* no point copying what would fill the buffer on its own */
+    if (len >= M_SOCK_OUTBUFSIZE)
+      return socket_write (conn, buf, len);
+  }
+
+  if (!conn->outbuf)
+    conn->outbuf = safe_malloc (M_SOCK_OUTBUFSIZE);
+  memcpy (conn->outbuf + conn->outlen, buf, len);
+  conn->outlen += len;
+
+  return len;
+}
+
+/* mutt_socket_flush: send what mutt_socket_buffer has collected */
+int mutt_socket_flush (CONNECTION* conn)
+{
+  int rc;
+
+  if (!conn->outlen)
+    return 0;
+
+  dprint (3, (debugfile, "mutt_socket_flush: sending %d bytes\n",
+              (int) conn->outlen));
+  rc = socket_write (conn, conn->outbuf, conn->outlen);
+  conn->outlen = 0;
+
+  return rc < 0 ? -1 : 0;
+}
+
 /* poll whether reads would block.
  *   Returns: >0 if there is data to read,
  *            0 if a read would block,
@@ -163,51 +234,208 @@ int mutt_socket_poll (CONNECTION* conn)
   return -1;
 }
 
-/* simple read buffering to speed things up. */
-int mutt_socket_readchar (CONNECTION *conn, char *c)
+/* mutt_socket_wait: sleep until the terminal has input, one of the
+ *   connections watch picks has something to read, or timeout milliseconds
+ *   have passed. This is what lets background work like prefetching wait
+ *   for its servers and the keyboard at once.
+ *   Returns: 1 if a watched connection is ready,
+ *            0 on timeout or signal,
+ *            -1 if the terminal is ready or there is nothing to watch */
+int mutt_socket_wait (int timeout, int (*watch) (CONNECTION*))
 {
-  if (conn->bufpos >= conn->available)
+  CONNECTION* conn;
+  fd_set rfds;
+  struct timeval tv;
+  int maxfd = 0, rc;
+
+  FD_ZERO (&rfds);
+  FD_SET (0, &rfds);
+  for (conn = Connections; conn; conn = conn->next)
   {
-    if (conn->fd >= 0)
-      conn->available = conn->conn_read (conn, conn->inbuf, sizeof (conn->inbuf));
-    else
-    {
-      dprint (1, (debugfile, "mutt_socket_readchar: attempt to read from closed connection.\n"));
-      return -1;
-    }
-    conn->bufpos = 0;
-    if (conn->available == 0)
+    if (conn->fd < 0 || !watch (conn))
+      continue;
+    /* input buffered above the socket never wakes select() */
+    if (mutt_socket_poll (conn) > 0)
+      return 1;
+    FD_SET (conn->fd, &rfds);
+    if (conn->fd > maxfd)
+      maxfd = conn->fd;
+  }
+  if (!maxfd)
+    return -1;
+
+  if (timeout < 0)
+    timeout = 0;
+  tv.tv_sec = timeout / 1000;
+  tv.tv_usec = (timeout % 1000) * 1000;
+
+  if ((rc = select (maxfd + 1, &rfds, NULL, NULL, &tv)) <= 0)
+    return 0;
+  if (FD_ISSET (0, &rfds))
+    return -1;
+
+  return 1;
+}
+
+/* socket_stall: wait for conn to send something, telling the user if it
+ *   takes a while and letting them give up with ^C. Returns -1 if they did,
+ *   after closing the connection. An interrupt which is already pending
+ *   is left to the caller. */
+static int socket_stall (CONNECTION* conn)
+{
+  struct sigaction oldsa;
+  fd_set rfds;
+  struct timeval tv;
+  time_t start;
+  char msg[SHORT_STRING];
+  int rc, waited = 0;
+
+  /* nobody to ask, an interrupt the caller has yet to see, or data (or an
+   * error the read will report) at hand */
+  if (option (OPTNOCURSES) || SigInt || !conn->conn_poll
+      || conn->conn_poll (conn) != 0)
+    return 0;
+
+  start = time (NULL);
+  sigaction (SIGINT, NULL, &oldsa);
+  mutt_allow_interrupt (1);
+  FOREVER
+  {
+    FD_ZERO (&rfds);
+    FD_SET (conn->fd, &rfds);
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    rc = select (conn->fd + 1, &rfds, NULL, NULL, &tv);
+    if (rc > 0 || (rc < 0 && errno != EINTR))
+      break;
+
+    if (SigInt)
     {
-      mutt_error (_("Connection to %s closed"), conn->account.host);
-      mutt_sleep (2);
+      snprintf (msg, sizeof (msg), _("Stop waiting for %s?"),
+                conn->account.host);
+      rc = mutt_yesorno (msg, M_NO);
+      SigInt = 0;
+      if (rc == M_YES)
+      {
+        dprint (1, (debugfile, "socket_stall: gave up on %s\n",
+                    conn->account.host));
+        sigaction (SIGINT, &oldsa, NULL);
+        mutt_socket_close (conn);
+        return -1;
+      }
+      /* keep waiting; the prompt has set its own disposition */
+      mutt_allow_interrupt (1);
+      mutt_clear_error ();
+      waited = 0;
+      start = time (NULL);
     }
-    if (conn->available <= 0)
+    else if (!waited && time (NULL) - start >= M_SOCK_STALL)
     {
-      mutt_socket_close (conn);
-      return -1;
+      mutt_message (_("Waiting for %s... (^C to stop)"), conn->account.host);
+      waited = 1;
     }
   }
+  sigaction (SIGINT, &oldsa, NULL);
+
+  if (waited)
+    mutt_clear_error ();
+
+  return 0;
+}
+
+/* socket_fill: refill the empty input buffer. Returns -1 on EOF or error,
+ *   after closing the connection. */
+static int socket_fill (CONNECTION* conn)
+{
+  /* the server may be waiting for the rest of our output */
+  if (conn->outlen && mutt_socket_flush (conn) < 0)
+    return -1;
+
+  if (conn->fd >= 0 && socket_stall (conn) < 0)
+    return -1;
+
+  if (conn->fd >= 0)
+    conn->available = conn->conn_read (conn, conn->inbuf, sizeof (conn->inbuf));
+  else
+  {
+    dprint (1, (debugfile, "socket_fill: attempt to read from closed connection.\n"));
+    return -1;
+  }
+  conn->bufpos = 0;
+  if (conn->available == 0)
+  {
+    mutt_error (_("Connection to %s closed"), conn->account.host);
+    mutt_sleep (2);
+  }
+  if (conn->available <= 0)
+  {
+    mutt_socket_close (conn);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* simple read buffering to speed things up. */
+int mutt_socket_readchar (CONNECTION *conn, char *c)
+{
+  if (conn->bufpos >= conn->available && socket_fill (conn) < 0)
+    return -1;
   *c = conn->inbuf[conn->bufpos];
   conn->bufpos++;
   return 1;
 }
 
+/* mutt_socket_readspan: consume up to len bytes of buffered input, reading
+ *   more from the connection only if the buffer is empty. *span points at
+ *   them inside the buffer until the next read. Returns the number of bytes,
+ *   or -1 on error. */
+int mutt_socket_readspan (CONNECTION* conn, const char** span, size_t len)
+{
+  size_t n;
+
+  if (conn->bufpos >= conn->available && socket_fill (conn) < 0)
+    return -1;
+
+  n = conn->available - conn->bufpos;
+  if (n > len)
+    n = len;
+  *span = conn->inbuf + conn->bufpos;
+  conn->bufpos += n;
+
+  return n;
+}
+
 int mutt_socket_readln_d (char* buf, size_t buflen, CONNECTION* conn, int dbg)
 {
-  char ch;
-  int i;
+  const char* span;
+  char* nl;
+  int i = 0, n;
 
-  for (i = 0; i < buflen-1; i++)
+  /* copy the buffered input up to the newline a span at a time */
+  while (i < buflen - 1)
   {
-    if (mutt_socket_readchar (conn, &ch) != 1)
+    if (conn->bufpos >= conn->available && socket_fill (conn) < 0)
     {
       buf[i] = '\0';
       return -1;
     }
 
-    if (ch == '\n')
+    span = conn->inbuf + conn->bufpos;
+    n = conn->available - conn->bufpos;
+    if (n > buflen - 1 - i)
+      n = buflen - 1 - i;
+    if ((nl = memchr (span, '\n', n)))
+      n = nl - span;
+
+    memcpy (buf + i, span, n);
+    conn->bufpos += n;
+    i += n;
+    if (nl)
+    {
+      conn->bufpos++;
       break;
-    buf[i] = ch;
+    }
   }
 
   /* strip \r from \r\n termination */
@@ -28,6 +28,9 @@
 #define M_SOCK_LOG_HDR  3
 #define M_SOCK_LOG_FULL 4
 
+/* size of the output buffer used by mutt_socket_buffer */
+#define M_SOCK_OUTBUFSIZE 65536
+
 typedef struct _connection
 {
   ACCOUNT account;
@@ -41,6 +44,10 @@ typedef struct _connection
   int fd;
   int available;
 
+  /* output collected by mutt_socket_buffer, allocated on first use */
+  char *outbuf;
+  size_t outlen;
+
   struct _connection *next;
 
   void *sockdata;
@@ -56,11 +63,16 @@ int mutt_socket_close (CONNECTION* conn);
 int mutt_socket_read (CONNECTION* conn, char* buf, size_t len);
 int mutt_socket_poll (CONNECTION* conn);
 int mutt_socket_readchar (CONNECTION *conn, char *c);
+int mutt_socket_readspan (CONNECTION* conn, const char** span, size_t len);
 #define mutt_socket_readln(A,B,C) mutt_socket_readln_d(A,B,C,M_SOCK_LOG_CMD)
 int mutt_socket_readln_d (char *buf, size_t buflen, CONNECTION *conn, int dbg);
 #define mutt_socket_write(A,B) mutt_socket_write_d(A,B,-1,M_SOCK_LOG_CMD)
 #define mutt_socket_write_n(A,B,C) mutt_socket_write_d(A,B,C,M_SOCK_LOG_CMD)
 int mutt_socket_write_d (CONNECTION *conn, const char *buf, int len, int dbg);
+#define mutt_socket_buffer(A,B,C) mutt_socket_buffer_d(A,B,C,M_SOCK_LOG_CMD)
+int mutt_socket_buffer_d (CONNECTION *conn, const char *buf, int len, int dbg);
+int mutt_socket_flush (CONNECTION *conn);
+int mutt_socket_wait (int timeout, int (*watch) (CONNECTION*));
 
 /* stupid hack for imap_logout_all */
 CONNECTION* mutt_socket_head (void);
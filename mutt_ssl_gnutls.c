@@ -86,6 +86,7 @@ static int tls_socket_read (CONNECTION* conn, char* buf, size_t len);
 static int tls_socket_write (CONNECTION* conn, const char* buf, size_t len);
 static int tls_socket_open (CONNECTION* conn);
 static int tls_socket_close (CONNECTION* conn);
+static int tls_socket_poll (CONNECTION* conn);
 static int tls_starttls_close (CONNECTION* conn);
 
 static int tls_init (void);
@@ -122,7 +123,7 @@ int mutt_ssl_socket_setup (CONNECTION* conn)
   conn->conn_read	= tls_socket_read;
   conn->conn_write	= tls_socket_write;
   conn->conn_close	= tls_socket_close;
-  conn->conn_poll       = raw_socket_poll;
+  conn->conn_poll       = tls_socket_poll;
 
   return 0;
 }
@@ -185,6 +186,18 @@ static int tls_socket_write (CONNECTION* conn, const char* buf, size_t len)
   return sent;
 }
 
+/* tls_socket_poll: a decrypted record may be waiting inside gnutls, where
+ *   select() can't see it */
+static int tls_socket_poll (CONNECTION* conn)
+{
+  tlssockdata *data = conn->sockdata;
+
+  if (data && gnutls_record_check_pending (data->state))
+    return 1;
+
+  return raw_socket_poll (conn);
+}
+
 static int tls_socket_open (CONNECTION* conn)
 {
   if (raw_socket_open (conn) < 0)
@@ -210,6 +223,7 @@ int mutt_ssl_starttls (CONNECTION* conn)
   conn->conn_read	= tls_socket_read;
   conn->conn_write	= tls_socket_write;
   conn->conn_close	= tls_starttls_close;
+  conn->conn_poll	= tls_socket_poll;
 
   return 0;
 }
@@ -510,6 +524,7 @@ static int tls_starttls_close (CONNECTION* conn)
   conn->conn_read = raw_socket_read;
   conn->conn_write = raw_socket_write;
   conn->conn_close = raw_socket_close;
+  conn->conn_poll = raw_socket_poll;
 
   return rc;
 }
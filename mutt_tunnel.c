@@ -45,7 +45,6 @@ static int tunnel_socket_open (CONNECTION*);
 static int tunnel_socket_close (CONNECTION*);
 static int tunnel_socket_read (CONNECTION* conn, char* buf, size_t len);
 static int tunnel_socket_write (CONNECTION* conn, const char* buf, size_t len);
-static int tunnel_socket_poll (CONNECTION* conn);
 
 /* -- public functions -- */
 int mutt_tunnel_socket_setup (CONNECTION *conn)
@@ -54,7 +53,7 @@ int mutt_tunnel_socket_setup (CONNECTION *conn)
   conn->conn_close = tunnel_socket_close;
   conn->conn_read = tunnel_socket_read;
   conn->conn_write = tunnel_socket_write;
-  conn->conn_poll = tunnel_socket_poll;
+  conn->conn_poll = raw_socket_poll;
 
   return 0;
 }
@@ -121,7 +120,8 @@ static int tunnel_socket_open (CONNECTION *conn)
   tunnel->writefd = pout[1];
   tunnel->pid = pid;
 
-  conn->fd = 42; /* stupid hack */
+  /* what the connection reads from, so it can be select()ed like a socket */
+  conn->fd = tunnel->readfd;
 
   return 0;
 }
@@ -177,17 +177,3 @@ static int tunnel_socket_write (CONNECTION* conn, const char* buf, size_t len)
 
   return rc;
 }
-
-static int tunnel_socket_poll (CONNECTION* conn)
-{
-  TUNNEL_DATA* tunnel = (TUNNEL_DATA*) conn->sockdata;
-  int ofd;
-  int rc;
-
-  ofd = conn->fd;
-  conn->fd = tunnel->readfd;
-  rc = raw_socket_poll (conn);
-  conn->fd = ofd;
-
-  return rc;
-}
@@ -0,0 +1,216 @@
+/*
+ *     This program is free software; you can redistribute it and/or modify
+ *     it under the terms of the GNU General Public License as published by
+ *     the Free Software Foundation; either version 2 of the License, or
+ *     (at your option) any later version.
+ *
+ *     This program is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public License
+ *     along with this program; if not, write to the Free Software
+ *     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* deflate compression layer for connections (RFC 4978).
+ *
+ * Like the SASL security layer, this replaces the connection methods with
+ * wrappers which inflate/deflate the stream and call the underlying
+ * methods (raw, tunnel or TLS) with the original sockdata restored. */
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "mutt.h"
+#include "mutt_socket.h"
+#include "mutt_zstrm.h"
+
+#include <zlib.h>
+
+#define ZSTRM_BUFSIZE 8192
+
+typedef struct
+{
+  z_stream rz;
+  z_stream wz;
+  /* compressed input not yet inflated */
+  char rbuf[ZSTRM_BUFSIZE];
+  /* inflate may have more output for us without reading more input */
+  unsigned char rpending;
+  unsigned char eof;
+  char wbuf[ZSTRM_BUFSIZE];
+
+  /* underlying socket data */
+  void* sockdata;
+  int (*open) (CONNECTION* conn);
+  int (*close) (CONNECTION* conn);
+  int (*read) (CONNECTION* conn, char* buf, size_t len);
+  int (*write) (CONNECTION* conn, const char* buf, size_t count);
+  int (*poll) (CONNECTION* conn);
+} ZSTRM_DATA;
+
+static int zstrm_open (CONNECTION* conn);
+static int zstrm_close (CONNECTION* conn);
+static int zstrm_read (CONNECTION* conn, char* buf, size_t len);
+static int zstrm_write (CONNECTION* conn, const char* buf, size_t count);
+static int zstrm_poll (CONNECTION* conn);
+
+/* mutt_zstrm_wrap_conn: compress everything sent and received on conn from
+ *   now on. Call this right after the server has accepted COMPRESS. */
+void mutt_zstrm_wrap_conn (CONNECTION* conn)
+{
+  ZSTRM_DATA* zdata = safe_calloc (1, sizeof (ZSTRM_DATA));
+
+  /* raw deflate streams, no zlib header (RFC 4978 section 4) */
+  inflateInit2 (&zdata->rz, -15);
+  deflateInit2 (&zdata->wz, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                Z_DEFAULT_STRATEGY);
+
+  /* preserve old functions */
+  zdata->sockdata = conn->sockdata;
+  zdata->open = conn->conn_open;
+  zdata->close = conn->conn_close;
+  zdata->read = conn->conn_read;
+  zdata->write = conn->conn_write;
+  zdata->poll = conn->conn_poll;
+
+  /* and set up new functions */
+  conn->sockdata = zdata;
+  conn->conn_open = zstrm_open;
+  conn->conn_close = zstrm_close;
+  conn->conn_read = zstrm_read;
+  conn->conn_write = zstrm_write;
+  conn->conn_poll = zstrm_poll;
+
+  dprint (2, (debugfile, "mutt_zstrm_wrap_conn: compression enabled\n"));
+}
+
+static int zstrm_open (CONNECTION* conn)
+{
+  /* never called: the layer is added to an open connection */
+  return -1;
+}
+
+static int zstrm_close (CONNECTION* conn)
+{
+  ZSTRM_DATA* zdata = conn->sockdata;
+  int rc;
+
+  dprint (2, (debugfile, "zstrm_close: read %lu bytes as %lu, "
+              "wrote %lu bytes as %lu\n", zdata->rz.total_out,
+              zdata->rz.total_in, zdata->wz.total_in, zdata->wz.total_out));
+
+  /* restore connection's underlying methods */
+  conn->sockdata = zdata->sockdata;
+  conn->conn_open = zdata->open;
+  conn->conn_close = zdata->close;
+  conn->conn_read = zdata->read;
+  conn->conn_write = zdata->write;
+  conn->conn_poll = zdata->poll;
+
+  inflateEnd (&zdata->rz);
+  deflateEnd (&zdata->wz);
+  FREE (&zdata);
+
+  /* call underlying close */
+  rc = (conn->conn_close) (conn);
+
+  return rc;
+}
+
+static int zstrm_read (CONNECTION* conn, char* buf, size_t len)
+{
+  ZSTRM_DATA* zdata = conn->sockdata;
+  int rc, zrc;
+
+  for (;;)
+  {
+    if (zdata->eof)
+      return 0;
+
+    /* drain what has already been read before touching the socket */
+    if (zdata->rz.avail_in || zdata->rpending)
+    {
+      zdata->rz.next_out = (Bytef*) buf;
+      zdata->rz.avail_out = len;
+      zrc = inflate (&zdata->rz, Z_SYNC_FLUSH);
+
+      /* a full output buffer means there may be more to come */
+      zdata->rpending = (zdata->rz.avail_out == 0);
+      if (zrc == Z_STREAM_END)
+        zdata->eof = 1;
+      else if (zrc != Z_OK && zrc != Z_BUF_ERROR)
+      {
+        dprint (1, (debugfile, "zstrm_read: inflate error %d\n", zrc));
+        return -1;
+      }
+
+      if (zdata->rz.avail_out < len)
+        return len - zdata->rz.avail_out;
+    }
+
+    conn->sockdata = zdata->sockdata;
+    rc = zdata->read (conn, zdata->rbuf, sizeof (zdata->rbuf));
+    conn->sockdata = zdata;
+
+    if (rc <= 0)
+      return rc;
+
+    zdata->rz.next_in = (Bytef*) zdata->rbuf;
+    zdata->rz.avail_in = rc;
+  }
+}
+
+static int zstrm_write (CONNECTION* conn, const char* buf, size_t count)
+{
+  ZSTRM_DATA* zdata = conn->sockdata;
+  size_t n, off;
+  int rc, zrc;
+
+  zdata->wz.next_in = (Bytef*) buf;
+  zdata->wz.avail_in = count;
+
+  /* flush each write: mutt waits for the server's reply to what it sends */
+  do
+  {
+    zdata->wz.next_out = (Bytef*) zdata->wbuf;
+    zdata->wz.avail_out = sizeof (zdata->wbuf);
+    zrc = deflate (&zdata->wz, Z_SYNC_FLUSH);
+    if (zrc != Z_OK && zrc != Z_BUF_ERROR)
+    {
+      dprint (1, (debugfile, "zstrm_write: deflate error %d\n", zrc));
+      return -1;
+    }
+
+    n = sizeof (zdata->wbuf) - zdata->wz.avail_out;
+    conn->sockdata = zdata->sockdata;
+    for (off = 0; off < n; off += rc)
+      if ((rc = zdata->write (conn, zdata->wbuf + off, n - off)) < 0)
+        break;
+    conn->sockdata = zdata;
+
+    if (off < n)
+      return -1;
+  }
+  while (zdata->wz.avail_in || !zdata->wz.avail_out);
+
+  return count;
+}
+
+static int zstrm_poll (CONNECTION* conn)
+{
+  ZSTRM_DATA* zdata = conn->sockdata;
+  int rc;
+
+  if (zdata->rz.avail_in || zdata->rpending)
+    return 1;
+
+  conn->sockdata = zdata->sockdata;
+  rc = zdata->poll (conn);
+  conn->sockdata = zdata;
+
+  return rc;
+}
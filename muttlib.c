@@ -273,6 +273,8 @@ int mutt_remove_from_rx_list (RX_LIST **l, const char *str)
   {
     p = *l;
     last = NULL;
+    if (p)
+      mutt_free_rx_matcher (&p->matcher);
     while (p)
     {
       if (ascii_strcasecmp (str, p->rx->pattern) == 0)
@@ -326,6 +328,7 @@ void mutt_free_header (HEADER **h)
   FREE (&(*h)->maildir_flags);
   FREE (&(*h)->tree);
   FREE (&(*h)->path);
+  FREE (&(*h)->score_cache);
 #ifdef MIXMASTER
   mutt_free_list (&(*h)->chain);
 #endif
@@ -1813,6 +1816,7 @@ REGEXP *mutt_compile_regexp (const char *s, int flags)
   REGEXP *pp = safe_calloc (sizeof (REGEXP), 1);
   pp->pattern = safe_strdup (s);
   pp->rx = safe_calloc (sizeof (regex_t), 1);
+  pp->flags = flags;
   if (REGCOMP (pp->rx, NONULL(s), flags) != 0)
     mutt_free_regexp (&pp);
 
@@ -1837,6 +1841,7 @@ void mutt_free_rx_list (RX_LIST **list)
     p = *list;
     *list = (*list)->next;
     mutt_free_regexp (&p->rx);
+    mutt_free_rx_matcher (&p->matcher);
     FREE (&p);
   }
 }
@@ -1851,14 +1856,124 @@ void mutt_free_spam_list (SPAM_LIST **list)
     p = *list;
     *list = (*list)->next;
     mutt_free_regexp (&p->rx);
+    mutt_free_rx_matcher (&p->matcher);
     FREE (&p->template);
     FREE (&p);
   }
 }
 
+/* Lists of more than a few regexps are also compiled into one alternation
+ * of all entries, which is kept in the head of the list and thrown away
+ * whenever the list changes.  A string which does not match the
+ * alternation matches none of the entries, so the common case of a long
+ * `subscribe' or `alternates' list not matching costs a single pass over
+ * the string instead of one per entry.  Lists whose entries cannot be
+ * combined (back references, different flags) are not combined.
+ */
+#define RX_MATCHER_MIN 4
+
+struct rx_matcher
+{
+  regex_t rx;
+  int usable;
+};
+
+void mutt_free_rx_matcher (struct rx_matcher **m)
+{
+  if (!*m)
+    return;
+  if ((*m)->usable)
+    regfree (&(*m)->rx);
+  FREE (m);		/* __FREE_CHECKED__ */
+}
+
+static int rx_has_backref (const char *s)
+{
+  for (; *s; s++)
+  {
+    if (*s == '\\' && s[1])
+    {
+      if (isdigit ((unsigned char) s[1]))
+	return 1;
+      s++;
+    }
+  }
+  return 0;
+}
+
+/* add rx to the alternation being built in buf */
+static int rx_matcher_add (BUFFER *buf, const REGEXP *rx, const REGEXP *first)
+{
+  if (rx->flags != first->flags || rx_has_backref (rx->pattern))
+    return -1;
+  if (rx != first)
+    mutt_buffer_addch (buf, '|');
+  mutt_buffer_addch (buf, '(');
+  mutt_buffer_addstr (buf, rx->pattern);
+  mutt_buffer_addch (buf, ')');
+  return 0;
+}
+
+static struct rx_matcher *rx_matcher_compile (BUFFER *buf, int ok, int flags)
+{
+  struct rx_matcher *m = safe_calloc (1, sizeof (struct rx_matcher));
+
+  if (ok && REGCOMP (&m->rx, buf->data, REG_NOSUB | flags) == 0)
+    m->usable = 1;
+  FREE (&buf->data);
+  return m;
+}
+
+static struct rx_matcher *rx_list_matcher (RX_LIST *l)
+{
+  BUFFER buf;
+  RX_LIST *p;
+  int n = 0, ok = 1;
+
+  if (!l->matcher)
+  {
+    mutt_buffer_init (&buf);
+    for (p = l; p && ok; p = p->next, n++)
+      ok = rx_matcher_add (&buf, p->rx, l->rx) == 0;
+    l->matcher = rx_matcher_compile (&buf, ok && n >= RX_MATCHER_MIN,
+				     l->rx->flags);
+  }
+  return l->matcher->usable ? l->matcher : NULL;
+}
+
+static struct rx_matcher *spam_list_matcher (SPAM_LIST *l)
+{
+  BUFFER buf;
+  SPAM_LIST *p;
+  int n = 0, ok = 1;
+
+  if (!l->matcher)
+  {
+    mutt_buffer_init (&buf);
+    for (p = l; p && ok; p = p->next, n++)
+      ok = rx_matcher_add (&buf, p->rx, l->rx) == 0;
+    l->matcher = rx_matcher_compile (&buf, ok && n >= RX_MATCHER_MIN,
+				     l->rx->flags);
+  }
+  return l->matcher->usable ? l->matcher : NULL;
+}
+
 int mutt_match_rx_list (const char *s, RX_LIST *l)
 {
+  struct rx_matcher *m;
+
   if (!s)  return 0;
+
+  if (l && (m = rx_list_matcher (l)))
+  {
+    if (regexec (&m->rx, s, (size_t) 0, (regmatch_t *) 0, (int) 0) != 0)
+      return 0;
+#ifdef DEBUG
+    /* find the matching entry for the debug log only */
+    if (debuglevel < 5)
+#endif
+      return 1;
+  }
   
   for (; l; l = l->next)
   {
@@ -1883,11 +1998,17 @@ int mutt_match_spam_list (const char *s, SPAM_LIST *l, char *text, int textsize)
 {
   static regmatch_t *pmatch = NULL;
   static int nmatch = 0;
+  struct rx_matcher *m;
   int tlen = 0;
   char *p;
 
   if (!s) return 0;
 
+  /* the first matching entry is needed for the template */
+  if (l && (m = spam_list_matcher (l)) &&
+      regexec (&m->rx, s, (size_t) 0, (regmatch_t *) 0, (int) 0) != 0)
+    return 0;
+
   for (; l; l = l->next)
   {
     /* If this pattern needs more matches, expand pmatch. */
@@ -703,6 +703,74 @@ static int brailleCol = -1;
 
 static int check_attachment_marker (char *);
 
+/* match the color body patterns against the line n (buf) */
+static void
+resolve_body_colors (char *buf, struct line_t *lineInfo, int n)
+{
+  COLOR_LINE *color_line;
+  regmatch_t pmatch[1];
+  int found, offset, null_rx, i;
+  size_t nl;
+
+  /* don't consider line endings part of the buffer
+   * for regex matching */
+  if ((nl = mutt_strlen (buf)) > 0 && buf[nl-1] == '\n')
+    buf[nl-1] = 0;
+
+  i = 0;
+  offset = 0;
+  lineInfo[n].chunks = 0;
+  do
+  {
+    if (!buf[offset])
+      break;
+
+    found = 0;
+    null_rx = 0;
+    color_line = ColorBodyList;
+    while (color_line)
+    {
+      if (regexec (&color_line->rx, buf + offset, 1, pmatch,
+		   (offset ? REG_NOTBOL : 0)) == 0)
+      {
+	if (pmatch[0].rm_eo != pmatch[0].rm_so)
+	{
+	  if (!found)
+	  {
+	    if (++(lineInfo[n].chunks) > 1)
+	      safe_realloc (&(lineInfo[n].syntax), 
+			    (lineInfo[n].chunks) * sizeof (struct syntax_t));
+	  }
+	  i = lineInfo[n].chunks - 1;
+	  pmatch[0].rm_so += offset;
+	  pmatch[0].rm_eo += offset;
+	  if (!found ||
+	      pmatch[0].rm_so < (lineInfo[n].syntax)[i].first ||
+	      (pmatch[0].rm_so == (lineInfo[n].syntax)[i].first &&
+	       pmatch[0].rm_eo > (lineInfo[n].syntax)[i].last))
+	  {
+	    (lineInfo[n].syntax)[i].color = color_line->pair;
+	    (lineInfo[n].syntax)[i].first = pmatch[0].rm_so;
+	    (lineInfo[n].syntax)[i].last = pmatch[0].rm_eo;
+	  }
+	  found = 1;
+	  null_rx = 0;
+	}
+	else
+	  null_rx = 1; /* empty regexp; don't add it, but keep looking */
+      }
+      color_line = color_line->next;
+    }
+
+    if (null_rx)
+      offset++; /* avoid degenerate cases */
+    else
+      offset = (lineInfo[n].syntax)[i].last;
+  } while (found || null_rx);
+  if (nl > 0)
+    buf[nl] = '\n';
+}
+
 static void
 resolve_types (char *buf, char *raw, struct line_t *lineInfo, int n, int last,
 		struct q_class_t **QuoteList, int *q_level, int *force_redraw,
@@ -710,7 +778,7 @@ resolve_types (char *buf, char *raw, struct line_t *lineInfo, int n, int last,
 {
   COLOR_LINE *color_line;
   regmatch_t pmatch[1], smatch[1];
-  int found, offset, null_rx, i;
+  int i;
 
   if (n == 0 || ISHEADER (lineInfo[n-1].type))
   {
@@ -834,69 +902,15 @@ resolve_types (char *buf, char *raw, struct line_t *lineInfo, int n, int last,
   else
     lineInfo[n].type = MT_COLOR_NORMAL;
 
-  /* body patterns */
+  /* body patterns are only needed for lines which get displayed, so they
+   * are left for display_line() when just determining the line types */
   if (lineInfo[n].type == MT_COLOR_NORMAL || 
       lineInfo[n].type == MT_COLOR_QUOTED)
   {
-    size_t nl;
-
-    /* don't consider line endings part of the buffer
-     * for regex matching */
-    if ((nl = mutt_strlen (buf)) > 0 && buf[nl-1] == '\n')
-      buf[nl-1] = 0;
-
-    i = 0;
-    offset = 0;
-    lineInfo[n].chunks = 0;
-    do
-    {
-      if (!buf[offset])
-	break;
-
-      found = 0;
-      null_rx = 0;
-      color_line = ColorBodyList;
-      while (color_line)
-      {
-	if (regexec (&color_line->rx, buf + offset, 1, pmatch,
-		     (offset ? REG_NOTBOL : 0)) == 0)
-	{
-	  if (pmatch[0].rm_eo != pmatch[0].rm_so)
-	  {
-	    if (!found)
-	    {
-	      if (++(lineInfo[n].chunks) > 1)
-		safe_realloc (&(lineInfo[n].syntax), 
-			      (lineInfo[n].chunks) * sizeof (struct syntax_t));
-	    }
-	    i = lineInfo[n].chunks - 1;
-	    pmatch[0].rm_so += offset;
-	    pmatch[0].rm_eo += offset;
-	    if (!found ||
-		pmatch[0].rm_so < (lineInfo[n].syntax)[i].first ||
-		(pmatch[0].rm_so == (lineInfo[n].syntax)[i].first &&
-		 pmatch[0].rm_eo > (lineInfo[n].syntax)[i].last))
-	    {
-	      (lineInfo[n].syntax)[i].color = color_line->pair;
-	      (lineInfo[n].syntax)[i].first = pmatch[0].rm_so;
-	      (lineInfo[n].syntax)[i].last = pmatch[0].rm_eo;
-	    }
-	    found = 1;
-	    null_rx = 0;
-	  }
-	  else
-	    null_rx = 1; /* empty regexp; don't add it, but keep looking */
-	}
-	color_line = color_line->next;
-      }
-
-      if (null_rx)
-	offset++; /* avoid degenerate cases */
-      else
-	offset = (lineInfo[n].syntax)[i].last;
-    } while (found || null_rx);
-    if (nl > 0)
-      buf[nl] = '\n';
+    if (q_classify)
+      resolve_body_colors (buf, lineInfo, n);
+    else
+      lineInfo[n].chunks = -1;
   }
 }
 
@@ -1021,15 +1035,17 @@ trim_incomplete_mbyte(unsigned char *buf, size_t len)
   return len;
 }
 
+/* read the line at offset into buf and a copy without ANSI sequences and
+ * overstrike into fmt, unless *b_read shows that this was already done.
+ * returns the number of bytes read into buf or -1 at the end of the file */
 static int
 fill_buffer (FILE *f, LOFF_T *last_pos, LOFF_T offset, unsigned char **buf,
-	     unsigned char **fmt, size_t *blen, int *buf_ready)
+	     unsigned char **fmt, size_t *blen, int *b_read)
 {
   unsigned char *p, *q;
-  static int b_read;
   int l;
 
-  if (*buf_ready == 0)
+  if (*b_read < 0)
   {
     if (offset != *last_pos)
       fseeko (f, offset, 0);
@@ -1039,15 +1055,14 @@ fill_buffer (FILE *f, LOFF_T *last_pos, LOFF_T offset, unsigned char **buf,
       return (-1);
     }
     *last_pos = ftello (f);
-    b_read = (int) (*last_pos - offset);
-    *buf_ready = 1;
+    *b_read = (int) (*last_pos - offset);
 
     safe_realloc (fmt, *blen);
 
     /* incomplete mbyte characters trigger a segfault in regex processing for
      * certain versions of glibc. Trim them if necessary. */
-    if (b_read == *blen - 2)
-      b_read -= trim_incomplete_mbyte(*buf, b_read);
+    if (*b_read == *blen - 2)
+      *b_read -= trim_incomplete_mbyte(*buf, *b_read);
     
     /* copy "buf" to "fmt", but without bold and underline controls */
     p = *buf;
@@ -1082,7 +1097,7 @@ fill_buffer (FILE *f, LOFF_T *last_pos, LOFF_T offset, unsigned char **buf,
     }
     *q = 0;
   }
-  return b_read;
+  return *b_read;
 }
 
 
@@ -1278,7 +1293,7 @@ display_line (FILE *f, LOFF_T *last_pos, struct line_t **lineInfo, int n,
   size_t buflen = 0;
   unsigned char *buf_ptr = buf;
   int ch, vch, col, cnt, b_read;
-  int buf_ready = 0, change_last = 0;
+  int buf_read = -1, change_last = 0;
   int special;
   int offset;
   int def_color;
@@ -1295,7 +1310,8 @@ display_line (FILE *f, LOFF_T *last_pos, struct line_t **lineInfo, int n,
 
   if (*last == *max)
   {
-    safe_realloc (lineInfo, sizeof (struct line_t) * (*max += LINES));
+    /* grow geometrically, long messages have millions of lines */
+    safe_realloc (lineInfo, sizeof (struct line_t) * (*max += MAX (LINES, *max / 2)));
     for (ch = *last; ch < *max ; ch++)
     {
       memset (&((*lineInfo)[ch]), 0, sizeof (struct line_t));
@@ -1312,7 +1328,7 @@ display_line (FILE *f, LOFF_T *last_pos, struct line_t **lineInfo, int n,
     if ((*lineInfo)[n].type == -1)
     {
       /* determine the line class */
-      if (fill_buffer (f, last_pos, (*lineInfo)[n].offset, &buf, &fmt, &buflen, &buf_ready) < 0)
+      if (fill_buffer (f, last_pos, (*lineInfo)[n].offset, &buf, &fmt, &buflen, &buf_read) < 0)
       {
 	if (change_last)
 	  (*last)--;
@@ -1332,6 +1348,38 @@ display_line (FILE *f, LOFF_T *last_pos, struct line_t **lineInfo, int n,
       flags = 0; /* M_NOSHOW */
   }
 
+  /* the body patterns of a line are matched when it is first shown */
+  if (flags & M_SHOWCOLOR)
+  {
+    m = (*lineInfo)[n].continuation ? ((*lineInfo)[n].syntax)[0].first : n;
+    if ((*lineInfo)[m].chunks < 0)
+    {
+      if (m == n)
+      {
+	if (fill_buffer (f, last_pos, (*lineInfo)[n].offset, &buf, &fmt, &buflen, &buf_read) < 0)
+	{
+	  if (change_last)
+	    (*last)--;
+	  goto out;
+	}
+	resolve_body_colors ((char *) fmt, *lineInfo, n);
+      }
+      else
+      {
+	unsigned char *mbuf = NULL, *mfmt = NULL;
+	size_t mbuflen = 0;
+	int mbuf_read = -1;
+
+	if (fill_buffer (f, last_pos, (*lineInfo)[m].offset, &mbuf, &mfmt, &mbuflen, &mbuf_read) >= 0)
+	  resolve_body_colors ((char *) mfmt, *lineInfo, m);
+	else
+	  (*lineInfo)[m].chunks = 0;
+	FREE (&mbuf);
+	FREE (&mfmt);
+      }
+    }
+  }
+
   /* At this point, (*lineInfo[n]).quote may still be undefined. We 
    * don't want to compute it every time M_TYPES is set, since this
    * would slow down the "bottom" function unacceptably. A compromise
@@ -1341,7 +1389,7 @@ display_line (FILE *f, LOFF_T *last_pos, struct line_t **lineInfo, int n,
   if ((flags & M_SHOWCOLOR) && !(*lineInfo)[n].continuation &&
       (*lineInfo)[n].type == MT_COLOR_QUOTED && (*lineInfo)[n].quote == NULL)
   {
-    if (fill_buffer (f, last_pos, (*lineInfo)[n].offset, &buf, &fmt, &buflen, &buf_ready) < 0)
+    if (fill_buffer (f, last_pos, (*lineInfo)[n].offset, &buf, &fmt, &buflen, &buf_read) < 0)
     {
       if (change_last)
 	(*last)--;
@@ -1356,7 +1404,7 @@ display_line (FILE *f, LOFF_T *last_pos, struct line_t **lineInfo, int n,
 
   if ((flags & M_SEARCH) && !(*lineInfo)[n].continuation && (*lineInfo)[n].search_cnt == -1) 
   {
-    if (fill_buffer (f, last_pos, (*lineInfo)[n].offset, &buf, &fmt, &buflen, &buf_ready) < 0)
+    if (fill_buffer (f, last_pos, (*lineInfo)[n].offset, &buf, &fmt, &buflen, &buf_read) < 0)
     {
       if (change_last)
 	(*last)--;
@@ -1400,7 +1448,7 @@ display_line (FILE *f, LOFF_T *last_pos, struct line_t **lineInfo, int n,
   }
 
   if ((b_read = fill_buffer (f, last_pos, (*lineInfo)[n].offset, &buf, &fmt, 
-			     &buflen, &buf_ready)) < 0)
+			     &buflen, &buf_read)) < 0)
   {
     if (change_last)
       (*last)--;
@@ -1528,6 +1576,29 @@ upNLines (int nlines, struct line_t *info, int cur, int hiding)
   return cur;
 }
 
+/* Return the first line from i on in direction dir (1 or -1) which matches
+ * the current search, or -1.  Lines are only indexed and searched as far
+ * as needed, so finding a match near the top of a huge message does not
+ * require reading all of it.
+ */
+static int
+search_line (FILE *f, LOFF_T *last_pos, struct line_t **lineInfo, int i,
+	     int dir, int *last, int *max, int flags, int hiding,
+	     struct q_class_t **QuoteList, int *q_level, int *force_redraw,
+	     regex_t *SearchRE)
+{
+  for (; i >= 0 && i <= *last; i += dir)
+  {
+    if (display_line (f, last_pos, lineInfo, i, last, max, flags, QuoteList,
+		      q_level, force_redraw, SearchRE) != 0)
+      break;
+    if ((!hiding || (*lineInfo)[i].type != MT_COLOR_QUOTED) &&
+	!(*lineInfo)[i].continuation && (*lineInfo)[i].search_cnt > 0)
+      return i;
+  }
+  return -1;
+}
+
 static const struct mapping_t PagerHelp[] = {
   { N_("Exit"),	OP_EXIT },
   { N_("PrevPg"), OP_PREV_PAGE },
@@ -1739,8 +1810,7 @@ mutt_pager (const char *banner, const char *fname, int flags, pager_t *extra)
 	if (!lineInfo[i].continuation && ++j == lines)
 	{
 	  topline = i;
-	  if (!SearchFlag)
-	    break;
+	  break;
 	}
     }
 
@@ -2041,14 +2111,14 @@ search_next:
 	      (SearchBack &&ch==OP_SEARCH_OPPOSITE))
 	  {
 	    /* searching forward */
-	    for (i = wrapped ? 0 : topline + searchctx + 1; i < lastLine; i++)
-	    {
-	      if ((!hideQuoted || lineInfo[i].type != MT_COLOR_QUOTED) && 
-		    !lineInfo[i].continuation && lineInfo[i].search_cnt > 0)
-		break;
-	    }
+	    i = search_line (fp, &last_pos, &lineInfo,
+			     wrapped ? 0 : topline + searchctx + 1, 1,
+			     &lastLine, &maxLine,
+			     M_SEARCH | (flags & M_PAGER_NSKIP) | (flags & M_PAGER_NOWRAP),
+			     hideQuoted, &QuoteList, &q_level, &force_redraw,
+			     &SearchRE);
 
-	    if (i < lastLine)
+	    if (i >= 0)
 	      topline = i;
 	    else if (wrapped || !option (OPTWRAPSEARCH))
 	      mutt_error _("Not found.");
@@ -2062,13 +2132,22 @@ search_next:
 	  else
 	  {
 	    /* searching backward */
-	    for (i = wrapped ? lastLine : topline + searchctx - 1; i >= 0; i--)
+	    if (wrapped)
 	    {
-	      if ((!hideQuoted || (has_types && 
-		    lineInfo[i].type != MT_COLOR_QUOTED)) && 
-		    !lineInfo[i].continuation && lineInfo[i].search_cnt > 0)
-		break;
+	      /* index the rest of the message */
+	      i = lastLine;
+	      while (display_line (fp, &last_pos, &lineInfo, i, &lastLine,
+				   &maxLine, (flags & M_PAGER_NSKIP) | (flags & M_PAGER_NOWRAP),
+				   &QuoteList, &q_level, &force_redraw,
+				   &SearchRE) == 0)
+		i++;
 	    }
+	    i = search_line (fp, &last_pos, &lineInfo,
+			     wrapped ? lastLine - 1 : topline + searchctx - 1, -1,
+			     &lastLine, &maxLine,
+			     M_SEARCH | (flags & M_PAGER_NSKIP) | (flags & M_PAGER_NOWRAP),
+			     hideQuoted && has_types, &QuoteList, &q_level,
+			     &force_redraw, &SearchRE);
 
 	    if (i >= 0)
 	      topline = i;
@@ -2157,40 +2236,16 @@ search_next:
 	else
 	{
 	  SearchCompiled = 1;
-	  /* update the search pointers */
-	  i = 0;
-	  while (display_line (fp, &last_pos, &lineInfo, i, &lastLine, 
-				&maxLine, M_SEARCH | (flags & M_PAGER_NSKIP) | (flags & M_PAGER_NOWRAP),
-				&QuoteList, &q_level,
-				&force_redraw, &SearchRE) == 0)
-	    i++;
-
-	  if (!SearchBack)
-	  {
-	    /* searching forward */
-	    for (i = topline; i < lastLine; i++)
-	    {
-	      if ((!hideQuoted || lineInfo[i].type != MT_COLOR_QUOTED) && 
-		    !lineInfo[i].continuation && lineInfo[i].search_cnt > 0)
-		break;
-	    }
-
-	    if (i < lastLine) topline = i;
-	  }
-	  else
-	  {
-	    /* searching backward */
-	    for (i = topline; i >= 0; i--)
-	    {
-	      if ((!hideQuoted || lineInfo[i].type != MT_COLOR_QUOTED) && 
-		    !lineInfo[i].continuation && lineInfo[i].search_cnt > 0)
-		break;
-	    }
-
-	    if (i >= 0) topline = i;
-	  }
-
-	  if (lineInfo[topline].search_cnt == 0)
+	  /* lines are searched as they are needed, see search_line() */
+	  i = search_line (fp, &last_pos, &lineInfo, topline,
+			   SearchBack ? -1 : 1, &lastLine, &maxLine,
+			   M_SEARCH | (flags & M_PAGER_NSKIP) | (flags & M_PAGER_NOWRAP),
+			   hideQuoted, &QuoteList, &q_level, &force_redraw,
+			   &SearchRE);
+	  if (i >= 0)
+	    topline = i;
+
+	  if (lineInfo[topline].search_cnt <= 0)
 	  {
 	    SearchFlag = 0;
 	    mutt_error _("Not found.");
@@ -251,6 +251,148 @@ msg_search (CONTEXT *ctx, pattern_t* pat, int msgno)
   return match;
 }
 
+/* skip a bracket expression starting at s, returns a pointer to the
+ * closing bracket or to the terminating NUL */
+static const char *skip_bracket (const char *s)
+{
+  s++;
+  if (*s == '^')
+    s++;
+  if (*s == ']')
+    s++;
+  for (; *s && *s != ']'; s++)
+  {
+    if (*s == '[' && (s[1] == ':' || s[1] == '.' || s[1] == '='))
+    {
+      char c = s[1];
+
+      for (s += 2; *s && !(*s == c && s[1] == ']'); s++)
+	;
+      if (!*s)
+	break;
+      s++;
+    }
+  }
+  return s;
+}
+
+#define IS_LITERAL_CHAR(c) ((unsigned char) (c) < 128 && isprint ((unsigned char) (c)))
+
+static void flush_literal (char *cur, size_t *curlen, char *best, size_t *bestlen)
+{
+  if (*curlen > *bestlen)
+  {
+    memcpy (best, cur, *curlen);
+    *bestlen = *curlen;
+  }
+  *curlen = 0;
+}
+
+static void add_literal (char c, char *cur, size_t *curlen, char *best, size_t *bestlen)
+{
+  if (*curlen == STRING)
+    flush_literal (cur, curlen, best, bestlen);
+  cur[(*curlen)++] = c;
+}
+
+/* Return the longest run of printable ASCII characters which every string
+ * matched by s must contain, or NULL if no such run could be determined.
+ * If rx is set, s is an extended regular expression, otherwise a plain
+ * string.  This errs on the side of returning a shorter run or NULL;
+ * callers use it to rule out patterns which cannot match.
+ */
+static char *pattern_literal (const char *s, int rx)
+{
+  char cur[STRING], best[STRING];
+  size_t curlen = 0, bestlen = 0;
+  int depth = 0;
+
+  for (; *s; s++)
+  {
+    if (!rx)
+    {
+      if (IS_LITERAL_CHAR (*s))
+	add_literal (*s, cur, &curlen, best, &bestlen);
+      else
+	flush_literal (cur, &curlen, best, &bestlen);
+      continue;
+    }
+
+    if (depth)
+    {
+      /* grouped sub-expressions may be optional or alternatives */
+      if (*s == '\\' && s[1])
+	s++;
+      else if (*s == '[')
+      {
+	s = skip_bracket (s);
+	if (!*s)
+	  break;
+      }
+      else if (*s == '(')
+	depth++;
+      else if (*s == ')')
+	depth--;
+      continue;
+    }
+
+    switch (*s)
+    {
+      case '|':
+	return NULL;
+      case '(':
+	depth++;
+	flush_literal (cur, &curlen, best, &bestlen);
+	break;
+      case '[':
+	flush_literal (cur, &curlen, best, &bestlen);
+	s = skip_bracket (s);
+	if (!*s)
+	  s--;
+	break;
+      case '*':
+      case '?':
+      case '{':
+	/* the preceding character is optional */
+	if (curlen)
+	  curlen--;
+	flush_literal (cur, &curlen, best, &bestlen);
+	if (*s == '{')
+	  while (s[1] && *s != '}')
+	    s++;
+	break;
+      case '+':
+      case '.':
+      case '^':
+      case '$':
+      case ')':
+	flush_literal (cur, &curlen, best, &bestlen);
+	break;
+      case '\\':
+	/* only escaped metacharacters are literals, \< and friends are
+	 * GNU extensions */
+	if (s[1] && strchr (".[]()*+?{}|^$\\", s[1]))
+	  add_literal (*++s, cur, &curlen, best, &bestlen);
+	else
+	{
+	  flush_literal (cur, &curlen, best, &bestlen);
+	  if (s[1])
+	    s++;
+	}
+	break;
+      default:
+	if (IS_LITERAL_CHAR (*s))
+	  add_literal (*s, cur, &curlen, best, &bestlen);
+	else
+	  flush_literal (cur, &curlen, best, &bestlen);
+	break;
+    }
+  }
+  flush_literal (cur, &curlen, best, &bestlen);
+
+  return bestlen ? mutt_substrdup (best, best + bestlen) : NULL;
+}
+
 static int eat_regexp (pattern_t *pat, BUFFER *s, BUFFER *err)
 {
   BUFFER buf;
@@ -282,6 +424,7 @@ static int eat_regexp (pattern_t *pat, BUFFER *s, BUFFER *err)
   {
     pat->p.str = safe_strdup (buf.data);
     pat->ign_case = mutt_which_case (buf.data) == REG_ICASE;
+    pat->literal = pattern_literal (buf.data, 0);
     FREE (&buf.data);
   }
   else if (pat->groupmatch)
@@ -301,6 +444,7 @@ static int eat_regexp (pattern_t *pat, BUFFER *s, BUFFER *err)
       FREE (&pat->p.rx);
       return (-1);
     }
+    pat->literal = pattern_literal (buf.data, 1);
     FREE (&buf.data);
   }
 
@@ -770,6 +914,7 @@ void mutt_pattern_free (pattern_t **pat)
 
     if (tmp->child)
       mutt_pattern_free (&tmp->child);
+    FREE (&tmp->literal);
     FREE (&tmp);
   }
 }
@@ -1099,6 +1244,12 @@ static int match_threadcomplete(struct pattern_t *pat, pattern_exec_flag flags,
 int
 mutt_pattern_exec (struct pattern_t *pat, pattern_exec_flag flags, CONTEXT *ctx, HEADER *h)
 {
+#ifdef USE_IMAP
+  /* the server has evaluated this whole term (see imap_search) */
+  if (pat->imapmatch && ctx && ctx->magic == M_IMAP)
+    return (h->matched);
+#endif
+
   switch (pat->op)
   {
     case M_AND:
@@ -52,20 +52,47 @@ static int fetch_message (char *line, void *file)
   return 0;
 }
 
+/* throw away a line of a response nobody is waiting for any more */
+static int discard_line (char *line, void *data)
+{
+  return 0;
+}
+
+/* number of messages to request ahead, 0 to send one command at a time */
+static int pop_pipeline_depth (POP_DATA *pop_data)
+{
+  if (!pop_data->cmd_pipe || PopPipelineDepth < 0)
+    return 0;
+
+  return PopPipelineDepth;
+}
+
+/* queue the LIST and TOP commands read by pop_read_header */
+static int pop_queue_header (POP_DATA *pop_data, HEADER *h)
+{
+  char buf[SHORT_STRING];
+
+  snprintf (buf, sizeof (buf), "LIST %d\r\nTOP %d 0\r\n", h->refno, h->refno);
+  return pop_query_send (pop_data, buf);
+}
+
 /*
  * Read header
+ * If queued is set, the commands have already been sent by
+ * pop_queue_header and only the responses are read.
  * returns:
  *  0 on success
  * -1 - connection lost,
  * -2 - invalid command or execution error,
  * -3 - error writing to tempfile
  */
-static int pop_read_header (POP_DATA *pop_data, HEADER *h)
+static int pop_read_header (POP_DATA *pop_data, HEADER *h, int queued)
 {
   FILE *f;
   int ret, index;
   long length;
   char buf[LONG_STRING];
+  char err_msg[POP_CMD_RESPONSE];
   char tempfile[_POSIX_PATH_MAX];
 
   mutt_mktemp (tempfile, sizeof (tempfile));
@@ -76,13 +103,19 @@ static int pop_read_header (POP_DATA *pop_data, HEADER *h)
   }
 
   snprintf (buf, sizeof (buf), "LIST %d\r\n", h->refno);
-  ret = pop_query (pop_data, buf, sizeof (buf));
+  if (queued)
+    ret = pop_query_reply (pop_data, buf, sizeof (buf));
+  else
+    ret = pop_query (pop_data, buf, sizeof (buf));
   if (ret == 0)
   {
     sscanf (buf, "+OK %d %ld", &index, &length);
 
     snprintf (buf, sizeof (buf), "TOP %d 0\r\n", h->refno);
-    ret = pop_fetch_data (pop_data, buf, NULL, fetch_message, f);
+    if (queued)
+      ret = pop_fetch_reply (pop_data, buf, NULL, fetch_message, f);
+    else
+      ret = pop_fetch_data (pop_data, buf, NULL, fetch_message, f);
 
     if (pop_data->cmd_top == 2)
     {
@@ -103,6 +136,15 @@ static int pop_read_header (POP_DATA *pop_data, HEADER *h)
       }
     }
   }
+  else if (ret == -2 && queued)
+  {
+    /* the TOP queued along with the LIST still has to be read */
+    strfcpy (err_msg, pop_data->err_msg, sizeof (err_msg));
+    snprintf (buf, sizeof (buf), "TOP %d 0\r\n", h->refno);
+    if (pop_fetch_reply (pop_data, buf, NULL, discard_line, NULL) == -1)
+      ret = -1;
+    strfcpy (pop_data->err_msg, err_msg, sizeof (pop_data->err_msg));
+  }
 
   switch (ret)
   {
@@ -236,6 +278,7 @@ static header_cache_t *pop_hcache_open (POP_DATA *pop_data, const char *path)
 static int pop_fetch_headers (CONTEXT *ctx)
 {
   int i, ret, old_count, new_count, deleted;
+  int depth, next, queued = 0;
   unsigned short hcached = 0, bcached;
   POP_DATA *pop_data = (POP_DATA *)ctx->data;
   progress_t progress;
@@ -283,6 +326,9 @@ static int pop_fetch_headers (CONTEXT *ctx)
 
   if (ret == 0)
   {
+    depth = pop_pipeline_depth (pop_data);
+    next = old_count;
+
     for (i = 0, deleted = 0; i < old_count; i++)
     {
       if (ctx->hdrs[i]->refno == -1)
@@ -328,14 +374,36 @@ static int pop_fetch_headers (CONTEXT *ctx)
       }
       else
 #endif
-      if ((ret = pop_read_header (pop_data, ctx->hdrs[i])) < 0)
-	break;
-#if USE_HCACHE
-      else
       {
+	/* with PIPELINING, keep requesting the headers of up to
+	 * $pop_pipeline_depth messages ahead of the one being read */
+	for (next = MAX (next, i); next < new_count && queued < depth; next++)
+	{
+#if USE_HCACHE
+	  if (next > i && (data = mutt_hcache_fetch (hc, ctx->hdrs[next]->data, strlen)))
+	  {
+	    FREE (&data);
+	    continue;
+	  }
+#endif
+	  if ((ret = pop_queue_header (pop_data, ctx->hdrs[next])) < 0)
+	    break;
+	  queued++;
+	}
+
+	if (ret == 0)
+	{
+	  ret = pop_read_header (pop_data, ctx->hdrs[i], queued > 0);
+	  if (queued)
+	    queued--;
+	}
+	if (ret < 0)
+	  break;
+#if USE_HCACHE
 	mutt_hcache_store (hc, ctx->hdrs[i]->data, ctx->hdrs[i], 0, strlen, M_GENERATE_UIDVALIDITY);
+#endif
       }
-
+#if USE_HCACHE
       FREE(&data);
 #endif
 
@@ -372,6 +440,26 @@ static int pop_fetch_headers (CONTEXT *ctx)
 
     if (i > old_count)
       mx_update_context (ctx, i - old_count);
+
+    /* after an error, read the responses still in flight so that the
+     * connection stays in step with the commands sent */
+    for (; queued > 0 && pop_data->status == POP_CONNECTED; queued--)
+    {
+      char buf[LONG_STRING];
+
+      strfcpy (buf, "LIST\r\n", sizeof (buf));
+      if (pop_query_reply (pop_data, buf, sizeof (buf)) == -1
+	  || pop_fetch_reply (pop_data, "TOP\r\n", NULL, discard_line, NULL) == -1)
+	break;
+    }
+
+    /* some servers announce PIPELINING but can't cope with it:
+     * use one command at a time after a reconnect */
+    if (ret == -1 && depth)
+    {
+      dprint (1, (debugfile, "pop_fetch_headers: unset PIPELINING capability\n"));
+      pop_data->cmd_pipe = 0;
+    }
   }
 
 #if USE_HCACHE
@@ -619,7 +707,10 @@ int pop_fetch_message (MESSAGE* msg, CONTEXT* ctx, int msgno)
    * portion of the headers, those required for the main display.
    */
   if (bcache)
+  {
+    fflush (msg->fp);
     mutt_bcache_commit (pop_data->bcache, h->data);
+  }
   else
   {
     cache->index = h->index;
@@ -774,6 +865,7 @@ void pop_fetch_mail (void)
   char msgbuf[SHORT_STRING];
   char *url, *p;
   int i, delanswer, last = 0, msgs, bytes, rset = 0, ret;
+  int depth, next, queued = 0, fetched;
   CONNECTION *conn;
   CONTEXT ctx;
   MESSAGE *msg = NULL;
@@ -858,14 +950,37 @@ void pop_fetch_mail (void)
   snprintf (msgbuf, sizeof (msgbuf), _("Reading new messages (%d bytes)..."), bytes);
   mutt_message ("%s", msgbuf);
 
+  /* with PIPELINING, up to $pop_pipeline_depth messages are requested
+   * ahead and the DELE commands are sent together after the last one.
+   * The server only removes messages on QUIT, so this deletes the same
+   * messages as deleting each one right after fetching it. */
+  depth = pop_pipeline_depth (pop_data);
+  next = fetched = last;
+
   for (i = last + 1 ; i <= msgs ; i++)
   {
+    for (; next < msgs && queued < depth; queued++)
+    {
+      snprintf (buffer, sizeof (buffer), "RETR %d\r\n", ++next);
+      if (pop_query_send (pop_data, buffer) < 0)
+      {
+	mx_close_mailbox (&ctx, NULL);
+	goto fail;
+      }
+    }
+
     if ((msg = mx_open_new_message (&ctx, NULL, M_ADD_FROM)) == NULL)
       ret = -3;
     else
     {
       snprintf (buffer, sizeof (buffer), "RETR %d\r\n", i);
-      ret = pop_fetch_data (pop_data, buffer, NULL, fetch_message, msg->fp);
+      if (queued)
+      {
+	ret = pop_fetch_reply (pop_data, buffer, NULL, fetch_message, msg->fp);
+	queued--;
+      }
+      else
+	ret = pop_fetch_data (pop_data, buffer, NULL, fetch_message, msg->fp);
       if (ret == -3)
 	rset = 1;
 
@@ -878,7 +993,10 @@ void pop_fetch_mail (void)
       mx_close_message (&msg);
     }
 
-    if (ret == 0 && delanswer == M_YES)
+    if (ret == 0)
+      fetched = i;
+
+    if (ret == 0 && delanswer == M_YES && !depth)
     {
       /* delete the message on the server */
       snprintf (buffer, sizeof (buffer), "DELE %d\r\n", i);
@@ -904,6 +1022,41 @@ void pop_fetch_mail (void)
     mutt_message (_("%s [%d of %d messages read]"), msgbuf, i - last, msgs - last);
   }
 
+  /* read the messages still in flight after an error */
+  for (; queued > 0; queued--)
+  {
+    strfcpy (buffer, "RETR\r\n", sizeof (buffer));
+    if (pop_fetch_reply (pop_data, buffer, NULL, discard_line, NULL) == -1)
+    {
+      mx_close_mailbox (&ctx, NULL);
+      goto fail;
+    }
+  }
+
+  if (depth && delanswer == M_YES && !rset && fetched > last)
+  {
+    /* delete the fetched messages on the server */
+    for (i = last + 1; i <= fetched; i++)
+    {
+      snprintf (buffer, sizeof (buffer), "DELE %d\r\n", i);
+      if (pop_query_send (pop_data, buffer) < 0)
+	break;
+    }
+    for (i = last + 1, ret = 0; i <= fetched; i++)
+    {
+      snprintf (buffer, sizeof (buffer), "DELE %d\r\n", i);
+      if ((ret = pop_query_reply (pop_data, buffer, sizeof (buffer))) == -1)
+	break;
+      if (ret == -2)
+	mutt_error ("%s", pop_data->err_msg);
+    }
+    if (ret == -1)
+    {
+      mx_close_mailbox (&ctx, NULL);
+      goto fail;
+    }
+  }
+
   mx_close_mailbox (&ctx, NULL);
 
   if (rset)
@@ -67,6 +67,7 @@ typedef struct
   unsigned int cmd_user : 2;	/* optional command USER */
   unsigned int cmd_uidl : 2;	/* optional command UIDL */
   unsigned int cmd_top : 2;	/* optional command TOP */
+  unsigned int cmd_pipe : 1;	/* optional capability PIPELINING */
   unsigned int resp_codes : 1;	/* server supports extended response codes */
   unsigned int expire : 1;	/* expire is greater than 0 */
   unsigned int clear_cache : 1;
@@ -100,6 +101,9 @@ int pop_connect (POP_DATA *);
 int pop_open_connection (POP_DATA *);
 int pop_query_d (POP_DATA *, char *, size_t, char *);
 int pop_fetch_data (POP_DATA *, char *, progress_t *, int (*funct) (char *, void *), void *);
+int pop_query_send (POP_DATA *, const char *);
+int pop_query_reply (POP_DATA *, char *, size_t);
+int pop_fetch_reply (POP_DATA *, char *, progress_t *, int (*funct) (char *, void *), void *);
 int pop_reconnect (CONTEXT *);
 void pop_logout (CONTEXT *);
 void pop_error (POP_DATA *, char *);
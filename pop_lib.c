@@ -119,6 +119,9 @@ static int fetch_capa (char *line, void *data)
   else if (!ascii_strncasecmp (line, "TOP", 3))
     pop_data->cmd_top = 1;
 
+  else if (!ascii_strncasecmp (line, "PIPELINING", 10))
+    pop_data->cmd_pipe = 1;
+
   return 0;
 }
 
@@ -165,6 +168,7 @@ static int pop_capabilities (POP_DATA *pop_data, int mode)
     pop_data->cmd_user = 0;
     pop_data->cmd_uidl = 0;
     pop_data->cmd_top = 0;
+    pop_data->cmd_pipe = 0;
     pop_data->resp_codes = 0;
     pop_data->expire = 1;
     pop_data->login_delay = 0;
@@ -419,7 +423,6 @@ void pop_logout (CONTEXT *ctx)
 int pop_query_d (POP_DATA *pop_data, char *buf, size_t buflen, char *msg)
 {
   int dbg = M_SOCK_LOG_CMD;
-  char *c;
 
   if (pop_data->status != POP_CONNECTED)
     return -1;
@@ -435,6 +438,45 @@ int pop_query_d (POP_DATA *pop_data, char *buf, size_t buflen, char *msg)
 
   mutt_socket_write_d (pop_data->conn, buf, -1, dbg);
 
+  return pop_query_reply (pop_data, buf, buflen);
+}
+
+/*
+ * Queue a command without waiting for the response. The command is sent
+ * with the next write or read on the connection, and its response must
+ * be read later with pop_query_reply or pop_fetch_reply. Only use this
+ * when the server supports PIPELINING.
+ *  0 - successful,
+ * -1 - connection lost.
+ */
+int pop_query_send (POP_DATA *pop_data, const char *cmd)
+{
+  if (pop_data->status != POP_CONNECTED)
+    return -1;
+
+  if (mutt_socket_buffer (pop_data->conn, cmd, -1) < 0)
+  {
+    pop_data->status = POP_DISCONNECTED;
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Read the status line for the command in buf, which has already been
+ * sent. The response is returned in buf.
+ *  0 - successful,
+ * -1 - connection lost,
+ * -2 - invalid command or execution error.
+ */
+int pop_query_reply (POP_DATA *pop_data, char *buf, size_t buflen)
+{
+  char *c;
+
+  if (pop_data->status != POP_CONNECTED)
+    return -1;
+
   c = strpbrk (buf, " \r\n");
   *c = '\0';
   snprintf (pop_data->err_msg, sizeof (pop_data->err_msg), "%s: ", buf);
@@ -451,30 +493,17 @@ int pop_query_d (POP_DATA *pop_data, char *buf, size_t buflen, char *msg)
   return -2;
 }
 
-/*
- * This function calls  funct(*line, *data)  for each received line,
- * funct(NULL, *data)  if  rewind(*data)  needs, exits when fail or done.
- * Returned codes:
- *  0 - successful,
- * -1 - connection lost,
- * -2 - invalid command or execution error,
- * -3 - error in funct(*line, *data)
- */
-int pop_fetch_data (POP_DATA *pop_data, char *query, progress_t *progressbar,
-		    int (*funct) (char *, void *), void *data)
+/* read the lines of a multi-line response up to the terminating "." */
+static int fetch_lines (POP_DATA *pop_data, progress_t *progressbar,
+			int (*funct) (char *, void *), void *data)
 {
   char buf[LONG_STRING];
   char *inbuf;
   char *p;
-  int ret, chunk = 0;
+  int ret = 0, chunk = 0;
   long pos = 0;
   size_t lenbuf = 0;
 
-  strfcpy (buf, query, sizeof (buf));
-  ret = pop_query (pop_data, buf, sizeof (buf));
-  if (ret < 0)
-    return ret;
-
   inbuf = safe_malloc (sizeof (buf));
 
   FOREVER
@@ -519,6 +548,48 @@ int pop_fetch_data (POP_DATA *pop_data, char *query, progress_t *progressbar,
   return ret;
 }
 
+/*
+ * This function calls  funct(*line, *data)  for each received line,
+ * funct(NULL, *data)  if  rewind(*data)  needs, exits when fail or done.
+ * Returned codes:
+ *  0 - successful,
+ * -1 - connection lost,
+ * -2 - invalid command or execution error,
+ * -3 - error in funct(*line, *data)
+ */
+int pop_fetch_data (POP_DATA *pop_data, char *query, progress_t *progressbar,
+		    int (*funct) (char *, void *), void *data)
+{
+  char buf[LONG_STRING];
+  int ret;
+
+  strfcpy (buf, query, sizeof (buf));
+  ret = pop_query (pop_data, buf, sizeof (buf));
+  if (ret < 0)
+    return ret;
+
+  return fetch_lines (pop_data, progressbar, funct, data);
+}
+
+/*
+ * Like pop_fetch_data, but for a query already queued with
+ * pop_query_send. Responses must be read in the order the queries
+ * were sent.
+ */
+int pop_fetch_reply (POP_DATA *pop_data, char *query, progress_t *progressbar,
+		     int (*funct) (char *, void *), void *data)
+{
+  char buf[LONG_STRING];
+  int ret;
+
+  strfcpy (buf, query, sizeof (buf));
+  ret = pop_query_reply (pop_data, buf, sizeof (buf));
+  if (ret < 0)
+    return ret;
+
+  return fetch_lines (pop_data, progressbar, funct, data);
+}
+
 /* find message with this UIDL and set refno */
 static int check_uidl (char *line, void *data)
 {
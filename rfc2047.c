@@ -72,7 +72,7 @@ static size_t convert_string (ICONV_CONST char *f, size_t flen,
   {
     e = errno;
     FREE (&buf);
-    iconv_close (cd);
+    mutt_iconv_close (cd);
     errno = e;
     return (size_t)(-1);
   }
@@ -82,7 +82,7 @@ static size_t convert_string (ICONV_CONST char *f, size_t flen,
 
   safe_realloc (&buf, ob - buf + 1);
   *t = buf;
-  iconv_close (cd);
+  mutt_iconv_close (cd);
 
   return n;
 }
@@ -287,11 +287,11 @@ static size_t try_block (ICONV_CONST char *d, size_t dlen,
 	iconv (cd, 0, 0, &ob, &obl) == (size_t)(-1))
     {
       assert (errno == E2BIG);
-      iconv_close (cd);
+      mutt_iconv_close (cd);
       assert (ib > d);
       return (ib - d == dlen) ? dlen : ib - d + 1;
     }
-    iconv_close (cd);
+    mutt_iconv_close (cd);
   }
   else
   {
@@ -357,7 +357,7 @@ static size_t encode_block (char *s, char *d, size_t dlen,
     n1 = iconv (cd, &ib, &ibl, &ob, &obl);
     n2 = iconv (cd, 0, 0, &ob, &obl);
     assert (n1 != (size_t)(-1) && n2 != (size_t)(-1));
-    iconv_close (cd);
+    mutt_iconv_close (cd);
     return (*encoder) (s, buf1, ob - buf1, tocode);
   }
   else
@@ -624,103 +624,82 @@ void rfc2047_encode_adrlist (ADDRESS *addr, const char *tag)
   }
 }
 
-static int rfc2047_decode_word (char *d, const char *s, size_t len)
+/*
+ * Returns the charset of an encoded word already validated by
+ * find_encoded_word(), without any RFC 2231 language suffix.  The
+ * name is not terminated; its length is stored in len.
+ */
+static const char *rfc2047_word_charset (const char *s, size_t *len)
 {
-  const char *pp, *pp1;
-  char *pd, *d0;
   const char *t, *t1;
-  int enc = 0, count = 0;
-  char *charset = NULL;
-  int rv = -1;
 
-  pd = d0 = safe_malloc (strlen (s));
+  s += 2;
+  t = strchr (s, '?');
+  /* ignore language specification a la RFC 2231 */
+  if ((t1 = memchr (s, '*', t - s)))
+    t = t1;
+  *len = t - s;
+  return s;
+}
 
-  for (pp = s; (pp1 = strchr (pp, '?')); pp = pp1 + 1)
-  {
-    count++;
+/*
+ * Decodes the encoded-text of the encoded word [s, end), as found by
+ * find_encoded_word(), into d, which must have room for end - s bytes.
+ * Returns the number of bytes written; no charset conversion is done.
+ */
+static size_t rfc2047_decode_word (char *d, const char *s, const char *end)
+{
+  const char *pp;
+  char *pd = d;
+  int enc;
+
+  /* find_encoded_word() guarantees "=?charset?[BQ]?text?=" */
+  pp = strchr (s + 2, '?');
+  enc = (toupper ((unsigned char) pp[1]) == 'Q') ? ENCQUOTEDPRINTABLE : ENCBASE64;
+  end -= 2;
 
-    /* hack for non-compliant MUAs that allow unquoted question marks in encoded-text */
-    if (count == 4)
+  if (enc == ENCQUOTEDPRINTABLE)
+  {
+    for (pp += 3; pp < end; pp++)
     {
-      while (pp1 && *(pp1 + 1) != '=')
-	pp1 = strchr(pp1 + 1, '?');
-      if (!pp1)
-	  goto error_out_0;
+      if (*pp == '_')
+	*pd++ = ' ';
+      else if (*pp == '=' &&
+	       (!(pp[1] & ~127) && hexval(pp[1]) != -1) &&
+	       (!(pp[2] & ~127) && hexval(pp[2]) != -1))
+      {
+	*pd++ = (hexval(pp[1]) << 4) | hexval(pp[2]);
+	pp += 2;
+      }
+      else
+	*pd++ = *pp;
     }
+  }
+  else
+  {
+    int c, b = 0, k = 0;
 
-    switch (count)
+    for (pp += 3; pp < end; pp++)
     {
-      case 2:
-	/* ignore language specification a la RFC 2231 */        
-	t = pp1;
-        if ((t1 = memchr (pp, '*', t - pp)))
-	  t = t1;
-	charset = mutt_substrdup (pp, t);
-	break;
-      case 3:
-	if (toupper ((unsigned char) *pp) == 'Q')
-	  enc = ENCQUOTEDPRINTABLE;
-	else if (toupper ((unsigned char) *pp) == 'B')
-	  enc = ENCBASE64;
-	else
-	  goto error_out_0;
-	break;
-      case 4:
-	if (enc == ENCQUOTEDPRINTABLE)
-	{
-	  for (; pp < pp1; pp++)
-	  {
-	    if (*pp == '_')
-	      *pd++ = ' ';
-	    else if (*pp == '=' &&
-		     (!(pp[1] & ~127) && hexval(pp[1]) != -1) &&
-		     (!(pp[2] & ~127) && hexval(pp[2]) != -1))
-	    {
-	      *pd++ = (hexval(pp[1]) << 4) | hexval(pp[2]);
-	      pp += 2;
-	    }
-	    else
-	      *pd++ = *pp;
-	  }
-	  *pd = 0;
-	}
-	else if (enc == ENCBASE64)
-	{
-	  int c, b = 0, k = 0;
-
-	  for (; pp < pp1; pp++)
-	  {
-	    if (*pp == '=')
-	      break;
-	    if ((*pp & ~127) || (c = base64val(*pp)) == -1)
-	      continue;
-	    if (k + 6 >= 8)
-	    {
-	      k -= 2;
-	      *pd++ = b | (c >> k);
-	      b = c << (8 - k);
-	    }
-	    else
-	    {
-	      b |= c << (k + 2);
-	      k += 6;
-	    }
-	  }
-	  *pd = 0;
-	}
+      if (*pp == '=')
 	break;
+      if ((*pp & ~127) || (c = base64val(*pp)) == -1)
+	continue;
+      if (k + 6 >= 8)
+      {
+	k -= 2;
+	*pd++ = b | (c >> k);
+	b = c << (8 - k);
+      }
+      else
+      {
+	b |= c << (k + 2);
+	k += 6;
+      }
     }
   }
-  
-  if (charset)
-    mutt_convert_string (&d0, charset, Charset, M_ICONV_HOOK_FROM);
-  mutt_filter_unprintable (&d0);
-  strfcpy (d, d0, len);
-  rv = 0;
-error_out_0:
-  FREE (&charset);
-  FREE (&d0);
-  return rv;
+
+  return pd - d;
 }
 
 /*
@@ -799,27 +778,58 @@ static size_t lwsrlen (const char *s, size_t n)
   return len;
 }
 
+/* Is [s, e) only the white space rfc2047_decode() drops between two
+ * encoded words? */
+static int rfc2047_gap (const char *s, const char *e)
+{
+  size_t n = e - s;
+
+  if (!n)
+    return 1;
+  if (strspn (s, " \t\r\n") < n)
+    return 0;
+  /* with ignore_linear_white_space LWS doesn't end with CRLF */
+  return !option (OPTIGNORELWS) || !strchr ("\r\n", e[-1]);
+}
+
+/* Could assumed_charset change s?  Pure ASCII without ISO-2022 escapes
+ * reads the same in anything we may be asked to assume. */
+static int rfc2047_needs_assumed (const char *s)
+{
+  if (!AssumedCharset || !*AssumedCharset)
+    return 0;
+  for (; *s; s++)
+    if ((*s & 0x80) || *s == '\033')
+      return 1;
+  return 0;
+}
+
 /* try to decode anything that looks like a valid RFC2047 encoded
  * header field, ignoring RFC822 parsing rules
  */
 void rfc2047_decode (char **pd)
 {
-  const char *p, *q;
-  size_t m, n;
+  const char *p, *q, *chs, *chs1;
+  size_t m, n, chslen, chslen1, rawlen;
   int found_encoded = 0;
-  char *d0, *d;
+  char *d0, *d, *raw;
+  char charset[STRING];
   const char *s = *pd;
   size_t dlen;
 
   if (!s || !*s)
     return;
 
+  /* most headers contain no encoded words at all: leave them alone */
+  if (!(p = find_encoded_word (s, &q)) && !rfc2047_needs_assumed (s))
+    return;
+
   dlen = 4 * strlen (s); /* should be enough */
   d = d0 = safe_malloc (dlen + 1);
 
   while (*s && dlen > 0)
   {
-    if (!(p = find_encoded_word (s, &q)))
+    if (!p)
     {
       /* no encoded words */
       if (option (OPTIGNORELWS))
@@ -887,13 +897,33 @@ void rfc2047_decode (char **pd)
       }
     }
 
-    if (rfc2047_decode_word (d, p, dlen) == -1)
+    /*
+     * Decode this word and every directly following one in the same
+     * charset into a single buffer and convert that once; this also
+     * reassembles multibyte characters split across encoded words.
+     */
+    raw = safe_malloc (strlen (p) + 1);
+    rawlen = 0;
+    chs = rfc2047_word_charset (p, &chslen);
+    for (;;)
     {
-      /* could not decode word, fall back to displaying the raw string */
-      strfcpy(d, p, dlen);
+      rawlen += rfc2047_decode_word (raw + rawlen, p, q);
+      s = q;
+      if (!(p = find_encoded_word (s, &q)) || !rfc2047_gap (s, p))
+	break;
+      chs1 = rfc2047_word_charset (p, &chslen1);
+      if (chslen1 != chslen || ascii_strncasecmp (chs, chs1, chslen))
+	break;
     }
+    raw[rawlen] = 0;
+
+    strfcpy (charset, chs, MIN (chslen + 1, sizeof (charset)));
+    mutt_convert_string (&raw, charset, Charset, M_ICONV_HOOK_FROM);
+    mutt_filter_unprintable (&raw);
+    strfcpy (d, raw, dlen);
+    FREE (&raw);
+
     found_encoded = 1;
-    s = q;
     n = mutt_strlen (d);
     dlen -= n;
     d += n;
@@ -24,6 +24,30 @@
 #include "sort.h"
 #include <string.h>
 #include <stdlib.h>
+#include <sys/time.h>
+
+/* Score rules are analyzed for what they depend on.  Rules that only look
+ * at the headers of a message give the same answer every time, so their
+ * result is remembered per message (see HEADER->score_cache) and a rescore
+ * only has to evaluate rules that were added or recompiled since.  Rules
+ * that look at flags, threads, the message number, the score itself or at
+ * configuration such as `lists' and `alternates' are always re-evaluated.
+ */
+#define SCORE_DEP_HEADER	(1<<0)	/* envelope and header fields */
+#define SCORE_DEP_CONTENT	(1<<1)	/* message body, attachments */
+#define SCORE_DEP_FLAGS		(1<<2)	/* status flags */
+#define SCORE_DEP_THREAD	(1<<3)	/* thread structure */
+#define SCORE_DEP_CONFIG	(1<<4)	/* lists, alternates, groups */
+#define SCORE_DEP_POSITION	(1<<5)	/* message number in the mailbox */
+#define SCORE_DEP_SCORE		(1<<6)	/* score accumulated so far */
+
+#define SCORE_DEP_VOLATILE	(SCORE_DEP_FLAGS | SCORE_DEP_THREAD | \
+				 SCORE_DEP_CONFIG | SCORE_DEP_POSITION | \
+				 SCORE_DEP_SCORE)
+
+/* two bits per rule in HEADER->score_cache */
+#define SCORE_KNOWN	1
+#define SCORE_HIT	2
 
 typedef struct score_t
 {
@@ -31,10 +55,201 @@ typedef struct score_t
   pattern_t *pat;
   int val;
   int exact;		/* if this rule matches, don't evaluate any more */
+  int slot;		/* position of this rule in HEADER->score_cache */
+  unsigned int gen;	/* ScoreGen at the time pat was compiled */
+  int deps;		/* SCORE_DEP_* */
+  unsigned long evals;	/* number of times pat was executed */
+  unsigned long hits;	/* number of times pat matched */
+#ifdef DEBUG
+  double usecs;		/* time spent executing pat */
+#endif
   struct score_t *next;
 } SCORE;
 
 static SCORE *Score = NULL;
+static unsigned int ScoreGen = 0;
+static int ScoreSlots = 0;
+
+static int score_pattern_deps (const pattern_t *pat)
+{
+  int deps = 0;
+
+  for (; pat; pat = pat->next)
+  {
+    if (pat->groupmatch)
+      deps |= SCORE_DEP_CONFIG;
+
+    switch (pat->op)
+    {
+      case M_AND:
+      case M_OR:
+	deps |= score_pattern_deps (pat->child);
+	break;
+      case M_THREAD:
+	deps |= SCORE_DEP_THREAD | score_pattern_deps (pat->child);
+	break;
+      case M_DUPLICATED:
+      case M_UNREFERENCED:
+      case M_COLLAPSED:
+	deps |= SCORE_DEP_THREAD;
+	break;
+      case M_EXPIRED:
+      case M_SUPERSEDED:
+      case M_FLAG:
+      case M_TAG:
+      case M_NEW:
+      case M_UNREAD:
+      case M_REPLIED:
+      case M_OLD:
+      case M_READ:
+      case M_DELETED:
+	deps |= SCORE_DEP_FLAGS;
+	break;
+      case M_MESSAGE:
+	deps |= SCORE_DEP_POSITION;
+	break;
+      case M_SCORE:
+	deps |= SCORE_DEP_SCORE;
+	break;
+      case M_CRYPT_VERIFIED:
+	/* GOODSIGN is only set once the signature has been checked */
+	deps |= SCORE_DEP_FLAGS;
+	break;
+      case M_LIST:
+      case M_SUBSCRIBED_LIST:
+      case M_PERSONAL_RECIP:
+      case M_PERSONAL_FROM:
+	deps |= SCORE_DEP_CONFIG;
+	break;
+      case M_MIMEATTACH:
+	/* counted according to the `attachments' settings */
+	deps |= SCORE_DEP_CONTENT | SCORE_DEP_CONFIG;
+	break;
+      case M_BODY:
+      case M_HEADER:
+      case M_WHOLE_MSG:
+	deps |= SCORE_DEP_CONTENT;
+	break;
+      case M_TO:
+      case M_CC:
+      case M_SUBJECT:
+      case M_FROM:
+      case M_DATE:
+      case M_DATE_RECEIVED:
+      case M_ID:
+      case M_HORMEL:
+      case M_SENDER:
+      case M_SIZE:
+      case M_REFERENCE:
+      case M_RECIPIENT:
+      case M_ADDRESS:
+      case M_CRYPT_SIGN:
+      case M_CRYPT_ENCRYPT:
+      case M_PGP_KEY:
+      case M_XLABEL:
+	deps |= SCORE_DEP_HEADER;
+	break;
+      default:
+	/* anything not known to be stable is evaluated every time */
+	deps |= SCORE_DEP_VOLATILE;
+	break;
+    }
+  }
+
+  return deps;
+}
+
+/* find the lowest slot not used by any rule */
+static int score_free_slot (void)
+{
+  SCORE *tmp;
+  int slot;
+
+  for (slot = 0; slot < ScoreSlots; slot++)
+  {
+    for (tmp = Score; tmp; tmp = tmp->next)
+      if (tmp->slot == slot)
+	break;
+    if (!tmp)
+      return slot;
+  }
+  return ScoreSlots++;
+}
+
+static void score_free (SCORE **ptr)
+{
+  mutt_pattern_free (&(*ptr)->pat);
+  FREE (&(*ptr)->str);
+  FREE (ptr);		/* __FREE_CHECKED__ */
+}
+
+/* make h->score_cache hold all slots and forget the results of rules which
+ * were compiled after it was last brought up to date */
+static void score_cache_update (HEADER *h)
+{
+  SCORE *tmp;
+  int n;
+
+  if (h->score_slots < ScoreSlots)
+  {
+    n = (ScoreSlots + 3) / 4;
+    safe_realloc (&h->score_cache, n);
+    memset (h->score_cache + (h->score_slots + 3) / 4, 0,
+	    n - (h->score_slots + 3) / 4);
+    h->score_slots = n * 4;
+  }
+
+  if (h->score_gen == ScoreGen)
+    return;
+
+  for (tmp = Score; tmp; tmp = tmp->next)
+    if (tmp->gen > h->score_gen)
+      h->score_cache[tmp->slot / 4] &= ~(3 << (2 * (tmp->slot % 4)));
+  h->score_gen = ScoreGen;
+}
+
+static int score_rule_matches (SCORE *rule, HEADER *h)
+{
+  unsigned char *c = &h->score_cache[rule->slot / 4];
+  int shift = 2 * (rule->slot % 4);
+  int match;
+#ifdef DEBUG
+  struct timeval t0, t1;
+#endif
+
+  if (!(rule->deps & SCORE_DEP_VOLATILE) && (*c >> shift) & SCORE_KNOWN)
+    return (*c >> shift) & SCORE_HIT ? 1 : 0;
+
+#ifdef DEBUG
+  gettimeofday (&t0, NULL);
+#endif
+  match = mutt_pattern_exec (rule->pat, 0, NULL, h) > 0;
+#ifdef DEBUG
+  gettimeofday (&t1, NULL);
+  rule->usecs += (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_usec - t0.tv_usec);
+#endif
+  rule->evals++;
+  if (match)
+    rule->hits++;
+
+  *c = (*c & ~(3 << shift)) | ((SCORE_KNOWN | (match ? SCORE_HIT : 0)) << shift);
+  return match;
+}
+
+static void score_dump_stats (void)
+{
+#ifdef DEBUG
+  SCORE *tmp;
+
+  if (debuglevel < 2 || !debugfile)
+    return;
+
+  for (tmp = Score; tmp; tmp = tmp->next)
+    dprint (2, (debugfile, "score: %s: %s%d deps=0x%02x evals=%lu hits=%lu time=%.0fus\n",
+		tmp->str, tmp->exact ? "=" : "", tmp->val, tmp->deps,
+		tmp->evals, tmp->hits, tmp->usecs));
+#endif
+}
 
 void mutt_check_rescore (CONTEXT *ctx)
 {
@@ -59,6 +274,8 @@ void mutt_check_rescore (CONTEXT *ctx)
       mutt_score_message (ctx, ctx->hdrs[i], 1);
       ctx->hdrs[i]->pair = 0;
     }
+
+    score_dump_stats ();
   }
   unset_option (OPTNEEDRESCORE);
 }
@@ -98,12 +315,15 @@ int mutt_parse_score (BUFFER *buf, BUFFER *s, unsigned long data, BUFFER *err)
       return (-1);
     }
     ptr = safe_calloc (1, sizeof (SCORE));
+    ptr->slot = score_free_slot ();
     if (last)
       last->next = ptr;
     else
       Score = ptr;
     ptr->pat = pat;
     ptr->str = pattern;
+    ptr->gen = ++ScoreGen;
+    ptr->deps = score_pattern_deps (pat);
   } else
     /* 'buf' arg was cleared and 'pattern' holds the only reference;
      * as here 'ptr' != NULL -> update the value only in which case
@@ -130,10 +350,12 @@ void mutt_score_message (CONTEXT *ctx, HEADER *hdr, int upd_ctx)
 {
   SCORE *tmp;
 
+  score_cache_update (hdr);
+
   hdr->score = 0; /* in case of re-scoring */
   for (tmp = Score; tmp; tmp = tmp->next)
   {
-    if (mutt_pattern_exec (tmp->pat, 0, NULL, hdr) > 0)
+    if (score_rule_matches (tmp, hdr))
     {
       if (tmp->exact || tmp->val == 9999 || tmp->val == -9999)
       {
@@ -167,10 +389,10 @@ int mutt_parse_unscore (BUFFER *buf, BUFFER *s, unsigned long data, BUFFER *err)
       {
 	last = tmp;
 	tmp = tmp->next;
-	mutt_pattern_free (&last->pat);
-	FREE (&last);
+	score_free (&last);
       }
       Score = NULL;
+      ScoreSlots = 0;
     }
     else
     {
@@ -182,8 +404,7 @@ int mutt_parse_unscore (BUFFER *buf, BUFFER *s, unsigned long data, BUFFER *err)
 	    last->next = tmp->next;
 	  else
 	    Score = tmp->next;
-	  mutt_pattern_free (&tmp->pat);
-	  FREE (&tmp);
+	  score_free (&tmp);
 	  /* there should only be one score per pattern, so we can stop here */
 	  break;
 	}
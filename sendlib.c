@@ -209,47 +209,23 @@ static void encode_quoted (FGETCONV * fc, FILE *fout, int istext)
   }
 }
 
-static char b64_buffer[3];
-static short b64_num;
-static short b64_linelen;
+/* raw bytes per 72 column line of base64 output */
+#define B64_LINE_BYTES 54
 
+static unsigned char b64_buffer[B64_LINE_BYTES];
+static size_t b64_num;
+
+/* Encodes a whole output line at once rather than a quad at a time */
 static void b64_flush(FILE *fout)
 {
-  short i;
+  unsigned char line[2 * B64_LINE_BYTES];
 
   if(!b64_num)
     return;
 
-  if(b64_linelen >= 72)
-  {
-    fputc('\n', fout);
-    b64_linelen = 0;
-  }
-
-  for(i = b64_num; i < 3; i++)
-    b64_buffer[i] = '\0';
-
-  fputc(B64Chars[(b64_buffer[0] >> 2) & 0x3f], fout);
-  b64_linelen++;
-  fputc(B64Chars[((b64_buffer[0] & 0x3) << 4) | ((b64_buffer[1] >> 4) & 0xf) ], fout);
-  b64_linelen++;
-
-  if(b64_num > 1)
-  {
-    fputc(B64Chars[((b64_buffer[1] & 0xf) << 2) | ((b64_buffer[2] >> 6) & 0x3) ], fout);
-    b64_linelen++;
-    if(b64_num > 2)
-    {
-      fputc(B64Chars[b64_buffer[2] & 0x3f], fout);
-      b64_linelen++;
-    }
-  }
-
-  while(b64_linelen % 4)
-  {
-    fputc('=', fout);
-    b64_linelen++;
-  }
+  mutt_to_base64 (line, b64_buffer, b64_num, sizeof (line));
+  fputs ((char *) line, fout);
+  fputc('\n', fout);
 
   b64_num = 0;
 }
@@ -257,7 +233,7 @@ static void b64_flush(FILE *fout)
 
 static void b64_putc(char c, FILE *fout)
 {
-  if(b64_num == 3)
+  if(b64_num == sizeof (b64_buffer))
     b64_flush(fout);
 
   b64_buffer[b64_num++] = c;
@@ -268,7 +244,7 @@ static void encode_base64 (FGETCONV * fc, FILE *fout, int istext)
 {
   int ch, ch1 = EOF;
 
-  b64_num = b64_linelen = 0;
+  b64_num = 0;
 
   while ((ch = fgetconv (fc)) != EOF)
   {
@@ -278,7 +254,10 @@ static void encode_base64 (FGETCONV * fc, FILE *fout, int istext)
     ch1 = ch;
   }
   b64_flush(fout);
-  fputc('\n', fout);
+
+  /* every line b64_flush() writes is already terminated */
+  if (ch1 == EOF)
+    fputc('\n', fout);
 }
 
 static void encode_8bit (FGETCONV *fc, FILE *fout, int istext)
@@ -752,9 +731,9 @@ static size_t convert_file_to (FILE *file, const char *fromcode,
 
   for (i = 0; i < ncodes; i++)
     if (cd[i] != (iconv_t)(-1))
-      iconv_close (cd[i]);
+      mutt_iconv_close (cd[i]);
 
-  iconv_close (cd1);
+  mutt_iconv_close (cd1);
   FREE (&cd);
   FREE (&infos);
   FREE (&score);
@@ -56,12 +56,17 @@
 #define SMTP_AUTH_UNAVAIL 1
 #define SMTP_AUTH_FAIL    -1
 
+/* size of the file reads sent as one BDAT chunk */
+#define SMTP_CHUNKSIZE 32768
+
 enum {
   STARTTLS,
   AUTH,
   DSN,
   EIGHTBITMIME,
   SMTPUTF8,
+  PIPELINING,
+  CHUNKING,
 
   CAPMAX
 };
@@ -78,6 +83,10 @@ static int Esmtp = 0;
 static char* AuthMechs = NULL;
 static unsigned char Capabilities[(CAPMAX + 7)/ 8];
 
+/* connection kept open after the last message, see $smtp_session_timeout */
+static CONNECTION* Session = NULL;
+static time_t SessionTime = 0;
+
 static int smtp_code (char *buf, size_t len, int *n)
 {
   char code[4];
@@ -125,6 +134,10 @@ smtp_get_resp (CONNECTION * conn)
       mutt_bit_set (Capabilities, STARTTLS);
     else if (!ascii_strncasecmp ("SMTPUTF8", buf + 4, 8))
       mutt_bit_set (Capabilities, SMTPUTF8);
+    else if (!ascii_strncasecmp ("PIPELINING", buf + 4, 10))
+      mutt_bit_set (Capabilities, PIPELINING);
+    else if (!ascii_strncasecmp ("CHUNKING", buf + 4, 8))
+      mutt_bit_set (Capabilities, CHUNKING);
 
     if (smtp_code (buf, n, &n) < 0)
       return smtp_err_code;
@@ -138,8 +151,41 @@ smtp_get_resp (CONNECTION * conn)
     return -1;
 }
 
+/* smtp_cmd: send a command and read its response. With PIPELINING
+ *   (RFC 2920) the command is only queued, and *pending counts the
+ *   responses smtp_get_pending has to collect. */
+static int
+smtp_cmd (CONNECTION * conn, const char *cmd, int *pending)
+{
+  if (mutt_bit_isset (Capabilities, PIPELINING))
+  {
+    if (mutt_socket_buffer (conn, cmd, -1) == -1)
+      return smtp_err_write;
+    (*pending)++;
+    return 0;
+  }
+
+  if (mutt_socket_write (conn, cmd) == -1)
+    return smtp_err_write;
+  return smtp_get_resp (conn);
+}
+
+/* smtp_get_pending: read the responses to the commands smtp_cmd queued,
+ *   stopping at the first failure */
 static int
-smtp_rcpt_to (CONNECTION * conn, const ADDRESS * a)
+smtp_get_pending (CONNECTION * conn, int *pending)
+{
+  int r;
+
+  for (; *pending; (*pending)--)
+    if ((r = smtp_get_resp (conn)))
+      return r;
+
+  return 0;
+}
+
+static int
+smtp_rcpt_to (CONNECTION * conn, const ADDRESS * a, int *pending)
 {
   char buf[1024];
   int r;
@@ -157,9 +203,7 @@ smtp_rcpt_to (CONNECTION * conn, const ADDRESS * a)
                 a->mailbox, DsnNotify);
     else
       snprintf (buf, sizeof (buf), "RCPT TO:<%s>\r\n", a->mailbox);
-    if (mutt_socket_write (conn, buf) == -1)
-      return smtp_err_write;
-    if ((r = smtp_get_resp (conn)))
+    if ((r = smtp_cmd (conn, buf, pending)))
       return r;
     a = a->next;
   }
@@ -188,18 +232,6 @@ smtp_data (CONNECTION * conn, const char *msgfile)
   mutt_progress_init (&progress, _("Sending message..."), M_PROGRESS_SIZE,
                       NetInc, st.st_size);
 
-  snprintf (buf, sizeof (buf), "DATA\r\n");
-  if (mutt_socket_write (conn, buf) == -1)
-  {
-    safe_fclose (&fp);
-    return smtp_err_write;
-  }
-  if ((r = smtp_get_resp (conn)))
-  {
-    safe_fclose (&fp);
-    return r;
-  }
-
   while (fgets (buf, sizeof (buf) - 1, fp))
   {
     buflen = mutt_strlen (buf);
@@ -208,13 +240,13 @@ smtp_data (CONNECTION * conn, const char *msgfile)
       snprintf (buf + buflen - 1, sizeof (buf) - buflen + 1, "\r\n");
     if (buf[0] == '.')
     {
-      if (mutt_socket_write_d (conn, ".", -1, M_SOCK_LOG_FULL) == -1)
+      if (mutt_socket_buffer_d (conn, ".", -1, M_SOCK_LOG_FULL) == -1)
       {
         safe_fclose (&fp);
         return smtp_err_write;
       }
     }
-    if (mutt_socket_write_d (conn, buf, -1, M_SOCK_LOG_FULL) == -1)
+    if (mutt_socket_buffer_d (conn, buf, -1, M_SOCK_LOG_FULL) == -1)
     {
       safe_fclose (&fp);
       return smtp_err_write;
@@ -222,14 +254,14 @@ smtp_data (CONNECTION * conn, const char *msgfile)
     mutt_progress_update (&progress, ftell (fp), -1);
   }
   if (!term && buflen &&
-      mutt_socket_write_d (conn, "\r\n", -1, M_SOCK_LOG_FULL) == -1)
+      mutt_socket_buffer_d (conn, "\r\n", -1, M_SOCK_LOG_FULL) == -1)
   {
     safe_fclose (&fp);
     return smtp_err_write;
   }
   safe_fclose (&fp);
 
-  /* terminate the message body */
+  /* terminate the message body, sending the rest of it along */
   if (mutt_socket_write (conn, ".\r\n") == -1)
     return smtp_err_write;
 
@@ -239,6 +271,82 @@ smtp_data (CONNECTION * conn, const char *msgfile)
   return 0;
 }
 
+/* smtp_bdat: send the message in BDAT chunks (RFC 3030). Unlike DATA this
+ *   needs no dot-stuffing, so the file goes out in large reads, only with
+ *   bare LFs turned into CRLF. With PIPELINING the chunks don't wait for
+ *   each other's responses. */
+static int
+smtp_bdat (CONNECTION * conn, const char *msgfile)
+{
+  char cmd[SHORT_STRING];
+  char* buf;
+  char* chunk;
+  FILE *fp;
+  progress_t progress;
+  struct stat st;
+  size_t n, i, len;
+  int r = 0, last = 0, pending = 0, prev = EOF;
+
+  fp = fopen (msgfile, "r");
+  if (!fp)
+  {
+    mutt_error (_("SMTP session failed: unable to open %s"), msgfile);
+    return -1;
+  }
+  stat (msgfile, &st);
+  unlink (msgfile);
+  mutt_progress_init (&progress, _("Sending message..."), M_PROGRESS_SIZE,
+                      NetInc, st.st_size);
+
+  buf = safe_malloc (SMTP_CHUNKSIZE);
+  /* worst case every byte is a bare LF, plus a final CRLF and a NUL for
+   * the debug log */
+  chunk = safe_malloc (2 * SMTP_CHUNKSIZE + 3);
+
+  while (!last)
+  {
+    n = fread (buf, 1, SMTP_CHUNKSIZE, fp);
+    last = n < SMTP_CHUNKSIZE;
+
+    for (i = 0, len = 0; i < n; prev = buf[i++])
+    {
+      if (buf[i] == '\n' && prev != '\r')
+        chunk[len++] = '\r';
+      chunk[len++] = buf[i];
+    }
+    /* like DATA, end the message with a line terminator */
+    if (last && prev != EOF && prev != '\n')
+    {
+      chunk[len++] = '\r';
+      chunk[len++] = '\n';
+    }
+    chunk[len] = '\0';
+
+    snprintf (cmd, sizeof (cmd), "BDAT %lu%s\r\n", (unsigned long) len,
+              last ? " LAST" : "");
+    if (mutt_socket_buffer (conn, cmd, -1) == -1 ||
+        mutt_socket_buffer_d (conn, chunk, len, M_SOCK_LOG_FULL) == -1)
+    {
+      r = smtp_err_write;
+      break;
+    }
+    pending++;
+    if (!mutt_bit_isset (Capabilities, PIPELINING) &&
+        (r = smtp_get_pending (conn, &pending)))
+      break;
+    mutt_progress_update (&progress, ftell (fp), -1);
+  }
+
+  if (!r)
+    r = smtp_get_pending (conn, &pending);
+
+  FREE (&chunk);
+  FREE (&buf);
+  safe_fclose (&fp);
+
+  return r;
+}
+
 
 /* Returns 1 if a contains at least one 8-bit character, 0 if none do.
  */
@@ -273,6 +381,42 @@ static int addresses_use_unicode(const ADDRESS* a)
 }
 
 
+/* smtp_reuse: whether the session left open by the last message can carry
+ *   this one too. Quits it if not. */
+static int smtp_reuse (CONNECTION* conn, int eightbit)
+{
+  if (!Session)
+    return 0;
+
+  /* a HELO session can't carry an 8-bit message. An idle server has
+   * nothing to say, unless it is hanging up on us. */
+  if (Session == conn && conn->fd >= 0 && (Esmtp || !eightbit)
+      && time (NULL) < SessionTime + SmtpSessionTimeout
+      && mutt_socket_poll (conn) == 0)
+  {
+    dprint (2, (debugfile, "smtp_reuse: reusing connection to %s\n",
+                conn->account.host));
+    return 1;
+  }
+
+  mutt_smtp_close ();
+  return 0;
+}
+
+/* mutt_smtp_close: quit the SMTP session kept open for the next message */
+void mutt_smtp_close (void)
+{
+  if (!Session)
+    return;
+
+  if (Session->fd >= 0)
+  {
+    mutt_socket_write (Session, "QUIT\r\n");
+    mutt_socket_close (Session);
+  }
+  Session = NULL;
+}
+
 int
 mutt_smtp_send (const ADDRESS* from, const ADDRESS* to, const ADDRESS* cc,
                 const ADDRESS* bcc, const char *msgfile, int eightbit)
@@ -281,7 +425,7 @@ mutt_smtp_send (const ADDRESS* from, const ADDRESS* to, const ADDRESS* cc,
   ACCOUNT account;
   const char* envfrom;
   char buf[1024];
-  int ret = -1;
+  int ret = -1, pending = 0, reuse, body = 0;
 
   /* it might be better to synthesize an envelope from from user and host
    * but this condition is most likely arrived at accidentally */
@@ -301,14 +445,26 @@ mutt_smtp_send (const ADDRESS* from, const ADDRESS* to, const ADDRESS* cc,
   if (!(conn = mutt_conn_find (NULL, &account)))
     return -1;
 
-  Esmtp = eightbit;
+  reuse = smtp_reuse (conn, eightbit);
+  Session = NULL;
 
   do
   {
-    /* send our greeting */
-    if (( ret = smtp_open (conn)))
-      break;
-    FREE (&AuthMechs);
+    if (reuse)
+    {
+      /* start from a clean transaction */
+      if ((ret = smtp_cmd (conn, "RSET\r\n", &pending)))
+        break;
+    }
+    else
+    {
+      Esmtp = eightbit;
+
+      /* send our greeting */
+      if (( ret = smtp_open (conn)))
+        break;
+      FREE (&AuthMechs);
+    }
 
     /* send the sender's address */
     ret = snprintf (buf, sizeof (buf), "MAIL FROM:<%s>", envfrom);
@@ -326,32 +482,51 @@ mutt_smtp_send (const ADDRESS* from, const ADDRESS* to, const ADDRESS* cc,
 	 addresses_use_unicode(bcc)))
       ret += snprintf (buf + ret, sizeof (buf) - ret, " SMTPUTF8");
     safe_strncat (buf, sizeof (buf), "\r\n", 3);
-    if (mutt_socket_write (conn, buf) == -1)
-    {
-      ret = smtp_err_write;
-      break;
-    }
-    if ((ret = smtp_get_resp (conn)))
+    if ((ret = smtp_cmd (conn, buf, &pending)))
       break;
 
     /* send the recipient list */
-    if ((ret = smtp_rcpt_to (conn, to)) || (ret = smtp_rcpt_to (conn, cc))
-        || (ret = smtp_rcpt_to (conn, bcc)))
+    if ((ret = smtp_rcpt_to (conn, to, &pending))
+        || (ret = smtp_rcpt_to (conn, cc, &pending))
+        || (ret = smtp_rcpt_to (conn, bcc, &pending)))
       break;
 
-    /* send the message data */
-    if ((ret = smtp_data (conn, msgfile)))
+    /* send the message data. With PIPELINING, DATA ends the batch of
+     * envelope commands, all of which are answered now. */
+    if (!mutt_bit_isset (Capabilities, CHUNKING)
+        && (ret = smtp_cmd (conn, "DATA\r\n", &pending)))
+      break;
+    if ((ret = smtp_get_pending (conn, &pending)))
+      break;
+    body = 1;
+    if ((ret = mutt_bit_isset (Capabilities, CHUNKING) ?
+         smtp_bdat (conn, msgfile) : smtp_data (conn, msgfile)))
       break;
 
-    mutt_socket_write (conn, "QUIT\r\n");
+    /* keep the session for the next message */
+    if (SmtpSessionTimeout > 0)
+    {
+      Session = conn;
+      SessionTime = time (NULL);
+    }
+    else
+      mutt_socket_write (conn, "QUIT\r\n");
 
     ret = 0;
   }
   while (0);
 
-  if (conn)
+  if (!Session && conn->fd >= 0)
     mutt_socket_close (conn);
 
+  /* the server may have dropped the idle session. Nothing of the message
+   * has been sent yet, so just start over. */
+  if (reuse && !body && (ret == smtp_err_read || ret == smtp_err_write))
+  {
+    dprint (1, (debugfile, "mutt_smtp_send: lost the kept session, reconnecting\n"));
+    return mutt_smtp_send (from, to, cc, bcc, msgfile, eightbit);
+  }
+
   if (ret == smtp_err_read)
     mutt_error (_("SMTP session failed: read error"));
   else if (ret == smtp_err_write)
@@ -22,8 +22,13 @@
 
 #include "mutt.h"
 #include "sort.h"
+#include "mx.h"
 #include "mutt_idna.h"
 
+#ifdef USE_IMAP
+#include "imap.h"
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
@@ -303,8 +308,14 @@ void mutt_sort_headers (CONTEXT *ctx, int init)
     mutt_sleep (1);
     return;
   }
-  else 
+  else
+  {
+#ifdef USE_IMAP
+    /* let the server do the work if it can */
+    if (ctx->magic != M_IMAP || imap_sort (ctx) != 0)
+#endif
     qsort ((void *) ctx->hdrs, ctx->msgcount, sizeof (HEADER *), sortfunc);
+  }
 
   /* adjust the virtual message numbers */
   ctx->vcount = 0;